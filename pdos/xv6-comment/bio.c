@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -19,93 +19,438 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into chains, and each chain
+// belongs to one of NBUCKET buckets.  Each bucket has its own lock
+// and its own MRU list, so lookups of different blocks do not
+// contend with each other.  A buffer only moves between buckets
+// when it is recycled for a new block; bget() then steals the
+// least recently used clean buffer of some other bucket, holding
+// one bucket lock at a time.
+//
+// The cache is not a fixed array.  Buffer data is carved out of
+// kalloc() pages, and binit() sizes the cache from free memory:
+// it starts with NBUF buffers and bget() adds a page of buffers
+// at a time, up to BCACHEPCT percent of memory, before it starts
+// recycling.  When kalloc() runs out of pages it calls bshrink(),
+// which hands back a page whose buffers are all idle.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 31                           // bucket locks
+#define BPP     (PGSIZE/BSIZE)               // buffers per data page
+#define CPP     (PGSIZE/sizeof(struct buf*)) // hash chains per page
+#define NCPAGE  64                           // max pages of hash chains
+#define NODEV   ((uint)-1)                   // dev of an unhashed buffer
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+};
+
+struct {
+  struct bucket bucket[NBUCKET];
+  struct buf **chain[NCPAGE];  // hash chain heads, CPP per page
+  uint nchain;
+
+  struct spinlock lock;  // protects the fields below
+  int npage;             // data pages in the cache
+  int maxpage;           // don't grow beyond this many
+  int reserve;           // don't grow if fewer free pages than this
+  struct buf *freehdr;   // unused buf headers, through next
 } bcache;
 
+// Hash chain and bucket of (dev, blockno).
+// A chain's buffers are all on its bucket's list.
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev*31 + blockno) % bcache.nchain;
+}
+
+static struct buf**
+bchain(uint dev, uint blockno)
+{
+  uint i = bhash(dev, blockno);
+  return &bcache.chain[i / CPP][i % CPP];
+}
+
+static struct bucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[bhash(dev, blockno) % NBUCKET];
+}
+
+// Insert b at the most recently used end of bucket h.
+// Caller must hold h->lock.
+static void
+binsert(struct bucket *h, struct buf *b)
+{
+  b->next = h->head.next;
+  b->prev = &h->head;
+  h->head.next->prev = b;
+  h->head.next = b;
+}
+
+// Unlink b from whatever bucket list it is on, and from
+// its hash chain.  Caller must hold that bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  struct buf **pp;
+
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  if(b->dev != NODEV){
+    for(pp = bchain(b->dev, b->blockno); *pp != b; pp = &(*pp)->hnext)
+      ;
+    *pp = b->hnext;
+    b->dev = NODEV;
+  }
+}
+
+// Add a page of unhashed, invalid buffers to bucket h.
+// Returns 0 if the cache is at its size limit or memory is short.
+static int
+bgrow(struct bucket *h)
+{
+  struct buf *b, *first, *next;
+  char *data, *p;
+  int i;
+
+  acquire(&bcache.lock);
+  if(bcache.npage >= bcache.maxpage || kfreepages() < bcache.reserve){
+    release(&bcache.lock);
+    return 0;
+  }
+  bcache.npage++;
+  release(&bcache.lock);
+
+  if((data = kalloc()) == 0)
+    goto bad;
+
+  acquire(&bcache.lock);
+  first = 0;
+  for(i = 0; i < BPP; i++){
+    if(bcache.freehdr == 0){
+      // Carve a fresh page into headers.  Header pages
+      // are never freed; they are small next to the data.
+      release(&bcache.lock);
+      p = kalloc();
+      acquire(&bcache.lock);
+      if(p == 0)
+        break;
+      for(b = (struct buf*)p; b+1 <= (struct buf*)(p+PGSIZE); b++){
+        b->next = bcache.freehdr;
+        bcache.freehdr = b;
+      }
+    }
+    b = bcache.freehdr;
+    bcache.freehdr = b->next;
+    b->pnext = first;
+    first = b;
+  }
+  if(i < BPP){
+    while((b = first) != 0){
+      first = b->pnext;
+      b->next = bcache.freehdr;
+      bcache.freehdr = b;
+    }
+    release(&bcache.lock);
+    kfree(data);
+    goto bad;
+  }
+  release(&bcache.lock);
+
+  acquire(&h->lock);
+  for(b = first, i = 0; i < BPP; b = next, i++){
+    next = b->pnext;
+    if(next == 0)
+      b->pnext = first;  // close the ring
+    b->data = (uchar*)data + i*BSIZE;
+    b->dev = NODEV;
+    b->flags = 0;
+    b->hnext = 0;
+    b->iodone = 0;
+    binsert(h, b);
+  }
+  release(&h->lock);
+  return 1;
+
+bad:
+  acquire(&bcache.lock);
+  bcache.npage--;
+  release(&bcache.lock);
+  return 0;
+}
+
+// Take the least recently used non-busy and clean buffer
+// out of some bucket other than home, and return it unlinked.
+// "clean" because B_DIRTY and !B_BUSY means log.c
+// hasn't yet committed the changes to the buffer.
+// Only one bucket lock is held at a time, so two processes
+// stealing from each other's buckets cannot deadlock.
+static struct buf*
+bsteal(struct bucket *home)
+{
+  struct bucket *h;
+  struct buf *b;
+  int i;
+
+  h = home;
+  for(i = 1; i < NBUCKET; i++){
+    if(++h == bcache.bucket+NBUCKET)
+      h = bcache.bucket;
+    acquire(&h->lock);
+    for(b = h->head.prev; b != &h->head; b = b->prev){
+      if((b->flags & (B_BUSY|B_DIRTY)) == 0){
+        bunlink(b);
+        release(&h->lock);
+        return b;
+      }
+    }
+    release(&h->lock);
+  }
+  return 0;
+}
+
+// Give one page of idle buffers back to kalloc().
+// Called by kalloc() when it runs out of memory, so it
+// must not be called with any bucket lock held.
+// Returns 1 if a page was freed.
+int
+bshrink(void)
+{
+  struct bucket *h;
+  struct buf *b, *s;
+  char *data;
+
+  if(bcache.maxpage == 0)
+    return 0;  // binit() hasn't run yet
+  acquire(&bcache.lock);
+  if(bcache.npage*BPP - BPP < NBUF){
+    release(&bcache.lock);
+    return 0;
+  }
+  release(&bcache.lock);
+
+  // A page's buffers can be in any bucket, so stop the
+  // world: lock all buckets, always in the same order.
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    acquire(&h->lock);
+  data = 0;
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET && data == 0; h++){
+    for(b = h->head.prev; b != &h->head; b = b->prev){
+      if(b->flags & (B_BUSY|B_DIRTY))
+        continue;
+      for(s = b->pnext; s != b; s = s->pnext)
+        if(s->flags & (B_BUSY|B_DIRTY))
+          break;
+      if(s != b)
+        continue;
+      data = (char*)PGROUNDDOWN((uint)b->data);
+      do {
+        bunlink(s);
+        s = s->pnext;
+      } while(s != b);
+      break;
+    }
+  }
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    release(&h->lock);
+  if(data == 0)
+    return 0;
+
+  acquire(&bcache.lock);
+  s = b;
+  do {
+    s->next = bcache.freehdr;
+    bcache.freehdr = s;
+    s = s->pnext;
+  } while(s != b);
+  bcache.npage--;
+  release(&bcache.lock);
+  kfree(data);
+  return 1;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *h;
+  int i, n;
 
   initlock(&bcache.lock, "bcache");
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++){
+    initlock(&h->lock, "bcache.bucket");
+    h->head.prev = &h->head;
+    h->head.next = &h->head;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Size the cache from free memory.  Keep a reserve so that
+  // growing the cache never drives kalloc() into bshrink().
+  n = kfreepages();
+  bcache.maxpage = n / 100 * BCACHEPCT;
+  if(bcache.maxpage < (NBUF+BPP-1)/BPP)
+    bcache.maxpage = (NBUF+BPP-1)/BPP;
+  bcache.reserve = n / 16;
+
+  // About two buffers per hash chain when the cache is full.
+  n = (bcache.maxpage*BPP/2 + CPP-1) / CPP;
+  if(n > NCPAGE)
+    n = NCPAGE;
+  for(i = 0; i < n; i++){
+    if((bcache.chain[i] = (struct buf**)kalloc()) == 0)
+      panic("binit: chains");
+    memset(bcache.chain[i], 0, PGSIZE);
   }
+  bcache.nchain = n * CPP;
+
+  // Start with NBUF buffers; bget() grows the cache on demand.
+  for(i = 0; bcache.npage*BPP < NBUF; i++)
+    if(!bgrow(&bcache.bucket[i % NBUCKET]))
+      panic("binit: no memory");
 }
 
-// Look through buffer cache for sector on device dev.
+// Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return B_BUSY buffer.
+// If nowait is set, return 0 instead if the block is
+// already cached or there is no buffer to spare.
 static struct buf*
-bget(uint dev, uint sector)
+bget(uint dev, uint blockno, int nowait)
 {
-  struct buf *b;
+  struct bucket *h;
+  struct buf *b, *nb, **chain;
 
-  acquire(&bcache.lock);
+  h = bbucket(dev, blockno);
+  chain = bchain(dev, blockno);
+  nb = 0;
+  acquire(&h->lock);
 
  loop:
-  // Is the sector already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
+  // Is the block already cached?
+  for(b = *chain; b != 0; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(nb){
+        // Lost the race; keep the stolen buffer in this bucket.
+        binsert(h, nb);
+        nb = 0;
+      }
+      if(nowait){
+        release(&h->lock);
+        return 0;
+      }
       if(!(b->flags & B_BUSY)){
         b->flags |= B_BUSY;
-        release(&bcache.lock);
+        release(&h->lock);
         return b;
       }
-      sleep(b, &bcache.lock);
+      sleep(b, &h->lock);
       goto loop;
     }
   }
 
-  // Not cached; recycle some non-busy and clean buffer.
-  // "clean" because B_DIRTY and !B_BUSY means log.c
-  // hasn't yet committed the changes to the buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
+  // Not cached; use the buffer stolen on a previous pass,
+  // or recycle the least recently used clean one in this bucket.
+  if(nb == 0){
+    for(b = h->head.prev; b != &h->head; b = b->prev){
+      if((b->flags & (B_BUSY|B_DIRTY)) == 0){
+        nb = b;
+        bunlink(b);
+        break;
+      }
+    }
+  }
+  if(nb == 0){
+    // Grow the cache, or steal from another bucket.
+    // h->lock must be dropped to do that, so another process
+    // may cache the block in the meantime; look again afterwards.
+    release(&h->lock);
+    if(!bgrow(h) && (nb = bsteal(h)) == 0){
+      if(nowait)
+        return 0;
+      panic("bget: no buffers");
     }
+    acquire(&h->lock);
+    if(nb)
+      nb->flags = 0;
+    goto loop;
   }
-  panic("bget: no buffers");
+  nb->dev = dev;
+  nb->blockno = blockno;
+  nb->flags = B_BUSY;
+  nb->hnext = *chain;
+  *chain = nb;
+  binsert(h, nb);
+  release(&h->lock);
+  return nb;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+// Return a B_BUSY buf with the contents of the indicated disk block.
 struct buf*
-bread(uint dev, uint sector)
+bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, blockno, 0);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
+// Return a B_BUSY buf for a block that was just allocated,
+// zeroed instead of read from the disk, whose old contents
+// are of no use.  The caller fills it in and log_writes it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start reading block blockno into the cache without waiting.
+// Does nothing if the block is already cached.  The buffer
+// stays B_BUSY until the read completes, so a bread() of it
+// in the meantime just waits for the read to finish.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->iodone = brelse;  // nobody waits for it
+  iderw_async(b);
+}
+
+// Like bread, but only start the read.
+// Call bwait() before looking at b->data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if(!(b->flags & B_VALID))
+    iderw_async(b);
+  return b;
+}
+
 // Write b's contents to disk.  Must be B_BUSY.
 void
 bwrite(struct buf *b)
@@ -116,27 +461,64 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Like bwrite, but only start the write.
+// Call bwait() before releasing or reusing b.
+void
+bwrite_async(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwrite_async");
+  b->flags |= B_DIRTY;
+  iderw_async(b);
+}
+
+// Wait for bread_async or bwrite_async on b to finish.
+// Several requests can be started before waiting on any
+// of them, keeping the disk busy.
+void
+bwait(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwait");
+  iderw_wait(b);
+}
+
+// Called by the disk driver when a request on b finishes,
+// with interrupts off.  Runs b's completion callback, if any.
+void
+biodone(struct buf *b)
+{
+  void (*fn)(struct buf*);
+
+  if((fn = b->iodone) != 0){
+    b->iodone = 0;
+    fn(b);
+  }
+}
+
 // Release a B_BUSY buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *h;
+  struct buf *p;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
+  h = bbucket(b->dev, b->blockno);
+  acquire(&h->lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  p = b->prev;
+  p->next = b->next;
+  b->next->prev = p;
+  binsert(h, b);
 
   b->flags &= ~B_BUSY;
   wakeup(b);
 
-  release(&bcache.lock);
+  release(&h->lock);
 }
 //PAGEBREAK!
 // Blank page.
@@ -1,13 +1,19 @@
 struct buf {
   int flags;
   uint dev;
-  uint sector;
+  uint blockno;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash chain
+  struct buf *pnext; // ring of buffers sharing a data page
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint qtime;        // ticks when queued to disk
+  void (*iodone)(struct buf*); // if set, called when the disk is done
+  uchar *data;       // BSIZE bytes carved from a kalloc() page
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_IO    0x8  // disk request in progress
+#define B_PAGE  0x10 // data is a page cache page; see pcache.c
 
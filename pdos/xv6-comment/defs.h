@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct page;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -11,9 +13,16 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+void            biodone(struct buf*);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
 void            brelse(struct buf*);
+struct buf*     bnew(uint, uint);
+void            bprefetch(uint, uint);
+int             bshrink(void);
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -35,6 +44,7 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+void            dcacheset(struct inode*, char*, uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -48,6 +58,9 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+int             imappable(struct inode*);
+struct page*    pagei(struct inode*, uint);
+void            readaheadi(struct inode*, uint, uint);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
@@ -56,15 +69,20 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderw_async(struct buf*);
+void            iderw_wait(struct buf*);
+void            idedump(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+void            ioapicroute(int irq, int vector, int cpu);
 
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -83,9 +101,21 @@ void            microdelay(int);
 // log.c
 void            initlog(void);
 void            log_write(struct buf*);
+int             log_holds(uint);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             mmap(uint, int, int, struct file*, uint);
+int             msync(uint, uint);
+int             munmap(uint, uint);
+void            munmapall(void);
+uint            vmabase(struct proc*);
+int             vmacheck(uint, uint, int);
+int             vmafault(uint, uint);
+int             vmastr(uint);
+int             vmafork(struct proc*);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
@@ -94,8 +124,24 @@ void            mpstartthem(void);
 
 // picirq.c
 void            picenable(int);
+void            piclevel(int);
 void            picinit(void);
 
+// pcache.c
+void            pcclean(struct buf*);
+void            pcdrop(uint, uint, uint);
+struct page*    pcget(uint, uint, uint);
+struct page*    pcheld(uint, uint, uint);
+void            pcinit(void);
+void            pcput(struct page*);
+int             pcshrink(void);
+
+// pci.c
+int             pcifind(int, int, struct pcidev*);
+int             pcifindid(int, int, struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -109,6 +155,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -143,6 +190,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -154,6 +202,7 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern int      ideirq;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -167,6 +216,8 @@ void            seginit(void);
 void            kvmalloc(void);
 void            vmenable(void);
 pde_t*          setupkvm(void);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
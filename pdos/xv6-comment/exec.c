@@ -87,6 +87,7 @@ exec(char *path, char **argv)
   safestrcpy(proc->name, last, sizeof(proc->name));
 
   // Commit to the user image.
+  munmapall();
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
@@ -6,8 +6,8 @@
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
-#include "file.h"
 #include "spinlock.h"
+#include "file.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -91,6 +91,38 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Read ahead of a sequential reader of f that has just read
+// r bytes at f->off.  A read that starts where the previous
+// one ended doubles the window, up to RAMAX blocks; a seek
+// closes it until the reader is sequential again.
+// Caller must hold f->ip->lock.
+static void
+readahead(struct file *f, int r)
+{
+  uint start, end;
+
+  if(f->off != f->raoff){
+    f->rawin = 0;
+    f->raend = 0;
+  } else if(f->rawin == 0)
+    f->rawin = 2;
+  else if(f->rawin < RAMAX)
+    f->rawin *= 2;
+  f->raoff = f->off + r;
+  if(f->rawin == 0)
+    return;
+
+  // Blocks up to raend were read ahead already.
+  start = (f->raoff + BSIZE - 1) / BSIZE * BSIZE;
+  if(start < f->raend)
+    start = f->raend;
+  end = f->raoff + f->rawin*BSIZE;
+  if(start >= end)
+    return;
+  readaheadi(f->ip, start, end - start);
+  f->raend = end;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -103,8 +135,10 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      readahead(f, r);
       f->off += r;
+    }
     iunlock(f->ip);
     return r;
   }
@@ -125,11 +159,14 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, extent tree blocks, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
+    // the chunks need not wait for each other's commits:
+    // the log copies a transaction's blocks when it commits,
+    // so later chunks fill the next one meanwhile.
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
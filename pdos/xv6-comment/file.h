@@ -8,6 +8,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // where the next read starts if access is sequential
+  uint raend;  // end of the range already read ahead
+  int rawin;   // read-ahead window in blocks; 0 if access is random
 };
 
 
@@ -17,13 +20,28 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct spinlock lock; // protects flags
+  struct inode *hnext;  // icache hash chain
+  struct inode *prev;   // icache LRU list
+  struct inode *next;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  short fmt;
+  union {
+    struct {
+      struct extenthdr eh;
+      struct extent ext[NEXTENT];
+    };
+    char data[NINLINE];
+  };
+
+  struct extent xcache; // extent bmap() used last; len 0 if none
+  int xlast;            // is xcache the file's last extent?
+  uint dirfree;         // directory has no free dirent before this offset
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
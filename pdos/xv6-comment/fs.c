@@ -19,83 +19,158 @@
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "page.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcacheinit(void);
+static void dcachepurge(uint dev, uint dir);
 
-// Read the super block.
-void
-readsb(int dev, struct superblock *sb)
+// Per-disk state: the super block, read once, and
+// where balloc() continues its search for a free block.
+struct fsdisk {
+  int valid;
+  struct superblock sb;
+  uint next;   // search cursor
+};
+
+struct {
+  struct spinlock lock;
+  struct fsdisk disk[NDISK];
+} fsdisks;
+
+// Return dev's state, reading its super block if needed.
+static struct fsdisk*
+fsdisk(uint dev)
 {
+  struct fsdisk *d;
   struct buf *bp;
-  
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
-  brelse(bp);
+
+  if(dev >= NDISK)
+    panic("fsdisk: bad dev");
+  d = &fsdisks.disk[dev];
+  if(!d->valid){
+    bp = bread(dev, 1);
+    acquire(&fsdisks.lock);
+    if(!d->valid){
+      memmove(&d->sb, bp->data, sizeof(d->sb));
+      d->next = 0;
+      d->valid = 1;
+    }
+    release(&fsdisks.lock);
+    brelse(bp);
+  }
+  return d;
 }
 
-// Zero a block.
-static void
-bzero(int dev, int bno)
+// Read the super block.
+void
+readsb(int dev, struct superblock *sb)
 {
-  struct buf *bp;
-  
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
-  brelse(bp);
+  *sb = fsdisk(dev)->sb;
 }
 
 // Blocks. 
 
-// Allocate a zeroed disk block.
+// Allocate up to *len contiguous disk blocks, as many as are
+// free after the first free block found, and set *len to
+// how many that was.  Return the first.
+// If near is not zero, prefer the first free block after it,
+// so that consecutive blocks of a file lie next to each other;
+// otherwise continue from where the last search stopped.
+// Either way the search wraps around, and stops short of
+// the log at the end of the disk, whose bits mkfs leaves clear.
+// The blocks are not zeroed, so that one about to be written
+// in full costs no disk read; get buffers for them with bnew().
 static uint
-balloc(uint dev)
+balloc(uint dev, uint near, uint *len)
 {
-  int b, bi, m;
+  uint b, start, n, end, k;
+  int bi, m;
   struct buf *bp;
-  struct superblock sb;
+  struct fsdisk *d;
+
+  d = fsdisk(dev);
+  acquire(&fsdisks.lock);
+  start = near ? near + 1 : d->next;
+  release(&fsdisks.lock);
+  end = d->sb.size - d->sb.nlog;
+  if(start >= end)
+    start = 0;
 
   bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(n = 0; n < end; n++){
+    b = (start + n) % end;
+    if(bp == 0 || b % BPB == 0){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+      bp = bread(dev, BBLOCK(b, d->sb.ninodes));
+    }
+    bi = b % BPB;
+    if(bi % 8 == 0 && bp->data[bi/8] == 0xff && b + 8 <= end){
+      n += 7;  // Skip a byte of used blocks.
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0 && !log_holds(b)){  // Is block free?
+      // Take the free blocks after it too, up to *len of
+      // them, as far as this bitmap block goes.  Skip blocks
+      // this transaction freed; see log_holds().
+      for(k = 0; k < *len && b + k < end; k++){
+        bi = (b + k) % BPB;
+        m = 1 << (bi % 8);
+        if((k > 0 && bi == 0) || (bp->data[bi/8] & m) != 0)
+          break;
+        if(k > 0 && log_holds(b + k))
+          break;
+        bp->data[bi/8] |= m;  // Mark block in use.
       }
+      *len = k;
+      log_write(bp);
+      brelse(bp);
+      acquire(&fsdisks.lock);
+      d->next = b + k;
+      release(&fsdisks.lock);
+      return b;
     }
-    brelse(bp);
   }
+  if(bp)
+    brelse(bp);
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Free n disk blocks starting at b.
 // 将对应的block 设置成空, 这里做这个操作也是事务的做,
 // 把某一个block直接设置成空, 在superblock里面
 static void
-bfree(int dev, uint b)
+bfree(int dev, uint b, uint n)
 {
   struct buf *bp;
   struct superblock sb;
   int bi, m;
 
   readsb(dev, &sb);
-  // 这里BBLOCK是获得这个block b所在的bitmap block的位置
-  // 然后将其修改, 然后下面的log_write 通过事务的方式去释放这个block
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bp = 0;
+  for(; n > 0; b++, n--){
+    if(bp == 0 || b % BPB == 0){
+      if(bp){
+        log_write(bp);
+        brelse(bp);
+      }
+      // 这里BBLOCK是获得这个block b所在的bitmap block的位置
+      // 然后将其修改, 然后下面的log_write 通过事务的方式去释放这个block
+      bp = bread(dev, BBLOCK(b, sb.ninodes));
+    }
+    bi = b % BPB;
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;
+  }
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
 }
 
 // Inodes.
@@ -123,12 +198,14 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
-//   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() to find or create a cache
+//   entry and increment its ref, iput() to decrement ref.
+//   An entry whose ref is zero stays cached, on an LRU
+//   list, so that a later iget() of the same inode can
+//   use it without reading the disk; it is recycled for
+//   another inode only once the cache has grown to NINODE.
 //
 //   这里就是对inode修改的时候会将内存中的flag设置成I_VALID, 当
 //   从dinode里面读取然后设置到inode时候会设置I_VALID,
@@ -143,7 +220,8 @@ bfree(int dev, uint b)
 //   the information in an inode and its content if it
 //   has first locked the inode. The I_BUSY flag indicates
 //   that the inode is locked. ilock() sets I_BUSY,
-//   while iunlock clears it.
+//   while iunlock clears it.  Waiting for I_BUSY uses the
+//   inode's own ip->lock, not icache.lock.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -163,16 +241,62 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+#define NIHASH 127  // inode hash chains
+
 // inode 里面的锁都是通过这个icache来实现, icache 
+// icache.lock protects the hash chains, the LRU list, the
+// free list and every ip->ref; ip->lock protects ip->flags.
+// The cache starts empty and grows a page of inodes at a time.
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through hnext
+  struct inode lru;            // ref == 0, through prev/next;
+                               // lru.next is most recently used
+  struct inode *free;          // never used, through next
+  int n;                       // inodes allocated
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  initlock(&fsdisks.lock, "fsdisks");
+  dcacheinit();
+}
+
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Take ip off the LRU list.  Caller must hold icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Add a page of inodes to the free list, unless the cache
+// is already NINODE big.  Caller must hold icache.lock.
+static void
+igrow(void)
+{
+  struct inode *ip;
+  char *p;
+
+  if(icache.n >= NINODE || (p = kalloc()) == 0)
+    return;
+  for(ip = (struct inode*)p; ip+1 <= (struct inode*)(p+PGSIZE); ip++){
+    memset(ip, 0, sizeof(*ip));
+    initlock(&ip->lock, "inode");
+    ip->next = icache.free;
+    icache.free = ip;
+    icache.n++;
+  }
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -196,6 +320,7 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      dip->fmt = type == T_FILE ? FMT_INLINE : FMT_EXTENTS;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -219,7 +344,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  dip->fmt = ip->fmt;
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
 }
@@ -230,31 +356,43 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Use a new entry while the cache may grow, else
+  // recycle the least recently used unreferenced one.
+  if(icache.free == 0)
+    igrow();
+  if((ip = icache.free) != 0)
+    icache.free = ip->next;
+  else {
+    ip = icache.lru.prev;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    lruremove(ip);
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  pp = ihash(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
   release(&icache.lock);
 
   return ip;
@@ -284,11 +422,11 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
+  acquire(&ip->lock);
   while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
+    sleep(ip, &ip->lock);
   ip->flags |= I_BUSY;
-  release(&icache.lock);
+  release(&ip->lock);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
@@ -298,7 +436,10 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->fmt = dip->fmt;
+    memmove(ip->data, dip->data, sizeof(ip->data));
+    ip->xcache.len = 0;
+    ip->dirfree = 0;
     brelse(bp);
     ip->flags |= I_VALID;
     if(ip->type == 0)
@@ -313,15 +454,15 @@ iunlock(struct inode *ip)
   if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
+  acquire(&ip->lock);
   ip->flags &= ~I_BUSY;
   wakeup(ip);
-  release(&icache.lock);
+  release(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry goes
+// on the LRU list, to be found again or recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -334,16 +475,27 @@ iput(struct inode *ip)
     // inode has no links and no other references: truncate and free.
     if(ip->flags & I_BUSY)
       panic("iput busy");
+    acquire(&ip->lock);
     ip->flags |= I_BUSY;
+    release(&ip->lock);
     release(&icache.lock);
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     acquire(&icache.lock);
+    acquire(&ip->lock);
     ip->flags = 0;
     wakeup(ip);
+    release(&ip->lock);
+  }
+  if(--ip->ref == 0){
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+    icache.lru.next->prev = ip;
+    icache.lru.next = ip;
   }
-  ip->ref--;
   release(&icache.lock);
 }
 
@@ -359,40 +511,241 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, found through the extents rooted
+// in ip->ext[]; see fs.h for the layout of the tree.
+
+#define EXTDEPTH 5  // deepest tree a file of MAXFILE blocks needs
+
+// Header and entries of the tree node in bp.
+#define NODEHDR(bp)  ((struct extenthdr*)(bp)->data)
+#define NODEEXT(bp)  ((struct extent*)(NODEHDR(bp) + 1))
+
+// Return the index of the last of the n entries in e that
+// starts at or before file block bn.
+static int
+extsearch(struct extent *e, int n, uint bn)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].lblk <= bn)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Copy to *x the extent of ip that maps file block bn or,
+// if bn is past the end of the file, the last extent.
+// x->len is 0 if ip has no blocks.
+static void
+extlookup(struct inode *ip, uint bn, struct extent *x)
+{
+  struct extent *e;
+  struct buf *bp, *nbp;
+  int n, depth, i;
+
+  memset(x, 0, sizeof(*x));
+  e = ip->ext;
+  n = ip->eh.n;
+  depth = ip->eh.depth;
+  bp = 0;
+  while(n > 0){
+    i = extsearch(e, n, bn);
+    if(depth == 0){
+      *x = e[i];
+      break;
+    }
+    nbp = bread(ip->dev, e[i].start);
+    if(bp)
+      brelse(bp);
+    bp = nbp;
+    if(NODEHDR(bp)->depth != depth - 1)
+      panic("extlookup: bad node");
+    depth = NODEHDR(bp)->depth;
+    n = NODEHDR(bp)->n;
+    e = NODEEXT(bp);
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Add the n disk blocks from b on to the end of ip as file
+// blocks bn on, by growing the last extent if b follows it.
+// Leaves the new last extent in ip->xcache.
+// Caller must iupdate(ip).
+static void
+extappend(struct inode *ip, uint bn, uint b, uint n)
+{
+  struct buf *path[EXTDEPTH+1], *bp;
+  struct extenthdr *h[EXTDEPTH+1];
+  struct extent *e[EXTDEPTH+1], *last, x;
+  int d, depth;
+  uint nb, one;
+
+again:
+  // Walk down the right edge of the tree.
+  depth = ip->eh.depth;
+  if(depth > EXTDEPTH)
+    panic("extappend: too deep");
+  h[0] = &ip->eh;
+  e[0] = ip->ext;
+  for(d = 1; d <= depth; d++){
+    path[d] = bread(ip->dev, e[d-1][h[d-1]->n-1].start);
+    h[d] = NODEHDR(path[d]);
+    e[d] = NODEEXT(path[d]);
+  }
+
+  if(h[depth]->n > 0){
+    last = &e[depth][h[depth]->n-1];
+    if(last->start + last->len == b && last->lblk + last->len == bn){
+      last->len += n;
+      if(depth > 0)
+        log_write(path[depth]);
+      ip->xcache = *last;
+      goto done;
+    }
+  }
+
+  // Find the lowest node on the edge with room for an entry.
+  for(d = depth; d >= 0; d--)
+    if(h[d]->n < (d == 0 ? NEXTENT : EPB))
+      break;
+  if(d < 0){
+    // All full: move the root's entries to a new node
+    // and make the root point to it.
+    for(d = 1; d <= depth; d++)
+      brelse(path[d]);
+    one = 1;
+    nb = balloc(ip->dev, 0, &one);
+    bp = bnew(ip->dev, nb);
+    *NODEHDR(bp) = ip->eh;
+    memmove(NODEEXT(bp), ip->ext, sizeof(ip->ext));
+    log_write(bp);
+    brelse(bp);
+    ip->eh.depth++;
+    ip->eh.n = 1;
+    ip->ext[0].start = nb;
+    ip->ext[0].len = 0;
+    goto again;
+  }
+
+  // Hang a new chain of nodes, one per level below d, off
+  // node d.  The leaf at the bottom holds the new extent.
+  x.lblk = bn;
+  x.start = b;
+  x.len = n;
+  while(depth > d){
+    one = 1;
+    nb = balloc(ip->dev, 0, &one);
+    bp = bnew(ip->dev, nb);
+    NODEHDR(bp)->n = 1;
+    NODEHDR(bp)->depth = ip->eh.depth - depth;
+    NODEEXT(bp)[0] = x;
+    log_write(bp);
+    brelse(bp);
+    x.start = nb;
+    x.len = 0;
+    depth--;
+  }
+  e[d][h[d]->n++] = x;
+  if(d > 0)
+    log_write(path[d]);
+  depth = ip->eh.depth;
+  ip->xcache.lblk = bn;
+  ip->xcache.start = b;
+  ip->xcache.len = n;
+
+done:
+  ip->xlast = 1;
+  for(d = 1; d <= depth; d++)
+    brelse(path[d]);
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If run is not 0, set *run to the number of blocks from there
+// on that are contiguous on disk, so sequential callers need
+// one lookup per extent rather than per block.
+// If there is no such block, bmap allocates one, just after
+// the file's last block if that is free.  Blocks are only
+// ever added at the end of a file.
+// The extent used is kept in ip->xcache, so that successive
+// calls in the same extent, or appends to the last one,
+// need not walk the tree again.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint *run)
+{
+  struct extent x;
+  uint addr, n;
+
+  if(ip->fmt == FMT_INLINE)
+    panic("bmap: inline");
+  x = ip->xcache;
+  if(x.len == 0 || bn < x.lblk || (bn >= x.lblk + x.len && !ip->xlast)){
+    extlookup(ip, bn, &x);
+    ip->xcache = x;
+    ip->xlast = bn >= x.lblk + x.len;
+  }
+  if(bn < x.lblk + x.len){
+    if(run)
+      *run = x.lblk + x.len - bn;
+    return x.start + bn - x.lblk;
+  }
+  if(bn != x.lblk + x.len)
+    panic("bmap: hole");
+  n = 1;
+  addr = balloc(ip->dev, x.len ? x.start + x.len - 1 : 0, &n);
+  extappend(ip, bn, addr, 1);
+  if(run)
+    *run = 1;
+  return addr;
+}
+
+// Append n new blocks to ip as file blocks bn on, asking
+// balloc() for all of them at once, so that they are
+// contiguous if the free space allows.
+// Caller must iupdate(ip).
+static void
+bappend(struct inode *ip, uint bn, uint n)
+{
+  uint b, got;
+
+  while(n > 0){
+    got = n;
+    b = balloc(ip->dev, bn > 0 ? bmap(ip, bn-1, 0) : 0, &got);
+    extappend(ip, bn, b, got);
+    bn += got;
+    n -= got;
+  }
+}
+
+// Free the blocks mapped by the n entries e of a tree
+// node at the given depth, and the nodes below it.
+static void
+extfree(uint dev, struct extent *e, int n, int depth)
 {
-  uint addr, *a;
   struct buf *bp;
+  int i;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  if(depth == 0){
+    for(i = 0; i < n; i++)
+      bfree(dev, e[i].start, e[i].len);
+    return;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
+  // Start reading all the children before freeing the first.
+  for(i = 0; i < n; i++)
+    bprefetch(dev, e[i].start);
+  for(i = 0; i < n; i++){
+    bp = bread(dev, e[i].start);
+    extfree(dev, NODEEXT(bp), NODEHDR(bp)->n, depth - 1);
     brelse(bp);
-    return addr;
+    bfree(dev, e[i].start, 1);
   }
-
-  panic("bmap: out of range");
 }
 
 // Truncate inode (discard contents).
@@ -401,37 +754,16 @@ bmap(struct inode *ip, uint bn)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
 // 这里是真正将文件删除的逻辑, 这里会依次的将inode
-// 里面的addrs里面记录的对应的block里面的数据给删除掉
+// 里面的extent记录的对应的block里面的数据给删除掉
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    // 这不部分释放的是DIRECT BLOCK
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
-  
-  // 这一部分释放的NDIRECT BLOCK
-  // 所以可以看到xv6 的一个文件最大的大小就是 
-  // NDIRECT + NINDIRECT
-  // NINDIRECT = BSIZE / sizeof(uint)
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
+  if(ip->type == T_FILE && ip->fmt == FMT_EXTENTS)
+    pcdrop(ip->dev, ip->inum, (ip->size + BSIZE-1) / BSIZE);
+  if(ip->fmt == FMT_EXTENTS)
+    extfree(ip->dev, ip->ext, ip->eh.n, ip->eh.depth);
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->xcache.len = 0;
 
   // 将这个文件的size 设置成0
   ip->size = 0;
@@ -450,15 +782,42 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return page pn of regular file ip from the page cache,
+// held and valid, or 0 if the cache has no page to give.
+// If fresh, the page's block was just allocated, so zero
+// the page instead of reading it.
+// Caller must hold ip->lock.
+static struct page*
+ipage(struct inode *ip, uint pn, int fresh)
+{
+  struct page *pg;
+
+  if((pg = pcget(ip->dev, ip->inum, pn)) == 0)
+    return 0;
+  if(!(pg->b.flags & (B_VALID|B_IO))){
+    pg->b.blockno = bmap(ip, pn, 0);
+    if(fresh){
+      memset(pg->b.data, 0, BSIZE);
+      pg->b.flags |= B_VALID;
+    } else
+      iderw_async(&pg->b);
+  }
+  iderw_wait(&pg->b);  // maybe started by readaheadi()
+  return pg;
+}
+
 //PAGEBREAK!
 // Read data from inode.
+// Regular files are read through the page cache,
+// directories through the buffer cache.
 // Readi 是从inode 里面读取信息, 常见的应用就是当inode存放的是目录的时候,
 // 
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -471,8 +830,27 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  if(ip->fmt == FMT_INLINE){
+    memmove(dst, ip->data + off, n);
+    return n;
+  }
+
+  if(ip->type == T_FILE){
+    for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+      if((pg = ipage(ip, off/BSIZE, 0)) == 0)
+        return -1;
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(dst, pg->b.data + off%BSIZE, m);
+      pcput(pg);
+    }
+    return n;
+  }
+
+  addr = run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m, addr++, run--){
+    if(run == 0)
+      addr = bmap(ip, off/BSIZE, &run);
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -480,13 +858,118 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Start reading the blocks holding bytes [off, off+n) of ip
+// into the page cache (or for a directory, the buffer cache),
+// without waiting for the disk.  Caller must hold ip->lock.
+// Blocks past the end of the file are skipped, so bmap()
+// never allocates here.
+void
+readaheadi(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, addr, run;
+  struct page *pg;
+
+  if(ip->type == T_DEV || ip->fmt == FMT_INLINE || off >= ip->size)
+    return;
+  end = ip->size;
+  if(off + n < end)
+    end = off + n;
+  addr = run = 0;
+  for(bn = off/BSIZE; bn*BSIZE < end; bn++, addr++, run--){
+    if(run == 0)
+      addr = bmap(ip, bn, &run);
+    if(ip->type != T_FILE){
+      bprefetch(ip->dev, addr);
+      continue;
+    }
+    if((pg = pcget(ip->dev, ip->inum, bn)) == 0)
+      return;
+    if(!(pg->b.flags & (B_VALID|B_IO))){
+      pg->b.blockno = addr;
+      iderw_async(&pg->b);
+    }
+    pcput(pg);
+  }
+}
+
+// Move the contents of inline file ip to a data block,
+// so that it can grow past NINLINE bytes.
+// Returns -1, leaving ip inline, if the page cache has no
+// page for the block.
+static int
+iexpand(struct inode *ip)
+{
+  char data[NINLINE];
+  struct page *pg;
+
+  pg = 0;
+  if(ip->size > 0 && (pg = pcget(ip->dev, ip->inum, 0)) == 0)
+    return -1;
+  memmove(data, ip->data, sizeof(data));
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->fmt = FMT_EXTENTS;
+  ip->xcache.len = 0;
+  if(pg){
+    pcput(ipage(ip, 0, 1));  // allocate and zero pg, held above
+    memmove(pg->b.data, data, ip->size);
+    log_write(&pg->b);
+    pcput(pg);
+  }
+  iupdate(ip);
+  return 0;
+}
+
+// Get regular file ip ready to be mapped: an inline file
+// moves to a block, since only blocks have pages.  mmap()
+// calls this, outside any transaction, so that a page fault
+// never has to start one.  Returns -1 if ip is not a regular
+// file or has no page for its block.
+int
+imappable(struct inode *ip)
+{
+  int r;
+
+  ilock(ip);
+  r = ip->type == T_FILE ? 0 : -1;
+  if(r == 0 && ip->fmt == FMT_INLINE){
+    iunlock(ip);
+    begin_op();
+    ilock(ip);
+    if(ip->fmt == FMT_INLINE)
+      r = iexpand(ip);
+    iunlock(ip);
+    end_op();
+    return r;
+  }
+  iunlock(ip);
+  return r;
+}
+
+// Return page pn of regular file ip, held and valid, for a
+// mapping; or 0 if the page is past the end of the file or
+// the page cache has none to give.  ip is not inline; see
+// imappable().
+struct page*
+pagei(struct inode *ip, uint pn)
+{
+  struct page *pg;
+
+  ilock(ip);
+  pg = 0;
+  if(ip->fmt != FMT_INLINE && pn < (ip->size + BSIZE-1) / BSIZE)
+    pg = ipage(ip, pn, 0);
+  iunlock(ip);
+  return pg;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run, nb, pn, npg;
   struct buf *bp;
+  struct page *pg, *held[MAXOPBLOCKS];
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -499,12 +982,67 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+  if(ip->fmt == FMT_INLINE){
+    if(off + n <= NINLINE){
+      memmove(ip->data + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(iexpand(ip) < 0)
+      return -1;
+  }
+
+  // Hold the pages this write covers before changing
+  // anything, so that if the page cache can't supply them
+  // the write fails having allocated nothing.  A transaction
+  // can't log more than MAXOPBLOCKS of them anyway.
+  npg = 0;
+  if(ip->type == T_FILE && n > 0){
+    if((off + n - 1)/BSIZE - off/BSIZE >= MAXOPBLOCKS)
+      return -1;
+    for(pn = off/BSIZE; pn <= (off + n - 1)/BSIZE; pn++){
+      if((held[npg] = pcget(ip->dev, ip->inum, pn)) == 0){
+        while(npg > 0)
+          pcput(held[--npg]);
+        return -1;
+      }
+      npg++;
+    }
+  }
+
+  // Allocate the blocks this write adds, all together.
+  // They need not be read: a new block is zeroed in the
+  // cache and then written like any other.
+  nb = (ip->size + BSIZE-1) / BSIZE;
+  if(off + n > nb*BSIZE)
+    bappend(ip, nb, (off + n - nb*BSIZE + BSIZE-1) / BSIZE);
+
+  if(ip->type == T_FILE){
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      pg = ipage(ip, off/BSIZE, off/BSIZE >= nb);  // one of held
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(pg->b.data + off%BSIZE, src, m);
+      log_write(&pg->b);
+      pcput(pg);
+    }
+    while(npg > 0)
+      pcput(held[--npg]);
+  } else {
+    addr = run = 0;
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m, addr++, run--){
+      if(run == 0)
+        addr = bmap(ip, off/BSIZE, &run);
+      if(off/BSIZE >= nb)
+        bp = bnew(ip->dev, addr);
+      else
+        bp = bread(ip->dev, addr);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(bp->data + off%BSIZE, src, m);
+      log_write(bp);
+      brelse(bp);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -523,36 +1061,475 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// dirlookup() scans a directory, so resolving a path costs a
+// scan per element.  dcache remembers the outcome of recent
+// lookups, (dev, directory inum, name) -> inum and offset,
+// including names that were not found.  A directory's
+// entries change only while it is locked, in dirlink() and
+// sys_unlink(), and those update dcache too, so a cached
+// answer is as good as a scan.
+
+#define NDHASH 251  // dcache hash chains
+
+struct dentry {
+  uint dev;
+  uint dir;             // inum of directory; 0 if unused
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in dir
+  uint off;             // of name's dirent in dir
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;    // lru.next is most recently used
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Return the entry for name in dir, or 0.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dir, name); d != 0; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Move d to the front of the LRU list, or to the back if
+// back is set.  Caller must hold dcache.lock.
+static void
+dmove(struct dentry *d, int back)
+{
+  struct dentry *at;
+
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  at = back ? dcache.lru.prev : &dcache.lru;
+  d->next = at->next;
+  d->prev = at;
+  at->next->prev = d;
+  at->next = d;
+}
+
+// Take d off its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// If dcache knows whether dp holds name, return 1 and set
+// *inum and *off; *inum is 0 if dp does not hold name.
+// Caller must hold dp's lock.
+static int
+dcacheget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  dmove(d, 0);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that directory dp holds name as inum, in the dirent
+// at offset off; or, if inum is 0, that dp does not hold name.
+// Caller must hold dp's lock.
+void
+dcacheset(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.lru.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = *dhash(d->dev, d->dir, d->name);
+    *dhash(d->dev, d->dir, d->name) = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dmove(d, 0);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir, which is being freed
+// and whose inum may be reused, or whose entries have moved.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++){
+    if(d->dev == dev && d->dir == dir){
+      dunhash(d);
+      dmove(d, 1);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Indexed directories; see fs.h.
+
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Return a pointer to entry i of the table in block 0.
+static ushort*
+dxent(struct buf *root, uint i)
+{
+  return &((struct dxslot*)root->data)[DXROOT+1 + i/DXSLOT].w[i%DXSLOT];
+}
+
+// Return the bucket block for name.
+static uint
+dxbucket(struct buf *root, char *name)
+{
+  struct dxslot *h;
+
+  h = &((struct dxslot*)root->data)[DXROOT];
+  return *dxent(root, dxhash(name) & ((1 << h->w[1]) - 1));
+}
+
+// Is directory dp indexed?
+// A linear directory is at most a block long,
+// unless an older kernel grew it.
+static int
+dxindexed(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxslot *h;
+  int r;
+
+  if(dp->size <= BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0, 0));
+  h = &((struct dxslot*)bp->data)[DXROOT];
+  r = h->zero == 0 && h->w[0] == DXMAGIC;
+  brelse(bp);
+  return r;
+}
+
+// Look for name in indexed directory dp.
+// Return its inum and set *poff, or return 0.
+static uint
+dxfind(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *root, *bp;
+  struct dirent *de;
+  uint bn, inum;
+  int i;
+
+  root = bread(dp->dev, bmap(dp, 0, 0));
+  de = (struct dirent*)root->data;
+  for(i = 0; i < DXROOT; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *poff = i*sizeof(*de);
+      inum = de[i].inum;
+      brelse(root);
+      return inum;
+    }
+  }
+  bn = dxbucket(root, name);
+  brelse(root);
+
+  bp = bread(dp->dev, bmap(dp, bn, 0));
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 1; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *poff = bn*BSIZE + i*sizeof(*de);
+      inum = de[i].inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Split full bucket bn of indexed directory dp: append a new
+// bucket and move into it the entries whose hash has the next
+// bit set, doubling the table first if it has no bit to spare.
+// Return -1 if the table is as large as it can be.
+static int
+dxsplit(struct inode *dp, struct buf *root, uint bn)
+{
+  struct dxslot *h, *oh, *nh;
+  struct dirent *ode, *nde;
+  struct buf *obp, *nbp;
+  uint depth, nb, i, j;
+
+  h = &((struct dxslot*)root->data)[DXROOT];
+  obp = bread(dp->dev, bmap(dp, bn, 0));
+  oh = (struct dxslot*)obp->data;
+  depth = oh->w[1];
+  if(depth == h->w[1]){
+    if(depth == DXMAXDEPTH){
+      brelse(obp);
+      return -1;
+    }
+    for(i = 0; i < (1 << depth); i++)
+      *dxent(root, i + (1 << depth)) = *dxent(root, i);
+    h->w[1]++;
+  }
+
+  nb = dp->size / BSIZE;
+  nbp = bnew(dp->dev, bmap(dp, nb, 0));
+  dp->size += BSIZE;
+  nh = (struct dxslot*)nbp->data;
+  nh->w[0] = DXMAGIC;
+  nh->w[1] = oh->w[1] = depth + 1;
+  ode = (struct dirent*)obp->data;
+  nde = (struct dirent*)nbp->data;
+  for(i = j = 1; i < DPB; i++){
+    if(ode[i].inum != 0 && (dxhash(ode[i].name) >> depth) & 1){
+      nde[j++] = ode[i];
+      memset(&ode[i], 0, sizeof(ode[i]));
+    }
+  }
+  for(i = 0; i < (1 << h->w[1]); i++)
+    if(*dxent(root, i) == bn && (i >> depth) & 1)
+      *dxent(root, i) = nb;
+
+  log_write(obp);
+  log_write(nbp);
+  log_write(root);
+  brelse(obp);
+  brelse(nbp);
+  iupdate(dp);
+  dcachepurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Return the offset of a free slot for name in indexed
+// directory dp, splitting its bucket if that is full, or -1.
+// A split leaves name's bucket about half full; if it is
+// still full, give up rather than grow the transaction.
+//
+// One split is what keeps dirlink() inside MAXOPBLOCKS.
+// A directory has at most 1 + (1<<DXMAXDEPTH) blocks, fewer
+// than NEXTENT*EPB, so its extent tree is at most one level
+// deep and an append logs at most one new or changed node,
+// plus the bitmap block the node came from.  A split logs
+// the root, the old and new buckets, the new bucket's bitmap
+// block, those two extent blocks and dp's inode: 7 at most.
+// dxconvert() logs the root, two buckets, two bitmap blocks
+// and the inode, and moves at most DPB-DXROOT entries, so
+// neither bucket is full and no split follows it.  mkdir is
+// the largest caller: the new inode's block, the new
+// directory's block and its bitmap block, then 7 for
+// dirlink(), 10 in all.
+static int
+dxplace(struct inode *dp, char *name)
+{
+  struct buf *root, *bp;
+  struct dirent *de;
+  uint bn;
+  int i, n;
+
+  root = bread(dp->dev, bmap(dp, 0, 0));
+  for(n = 0; ; n++){
+    bn = dxbucket(root, name);
+    bp = bread(dp->dev, bmap(dp, bn, 0));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i < DPB; i++)
+      if(de[i].inum == 0)
+        break;
+    brelse(bp);
+    if(i < DPB){
+      brelse(root);
+      return bn*BSIZE + i*sizeof(*de);
+    }
+    if(n == 1 || dxsplit(dp, root, bn) < 0)
+      break;
+  }
+  brelse(root);
+  return -1;
+}
+
+// Turn dp, a linear directory whose one block is full,
+// into an indexed directory with two buckets.
+// Return -1 if it does not begin with "." and "..".
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *root, *bp[2];
+  struct dirent *de, *bde;
+  struct dxslot *h;
+  int i, k, n[2];
+
+  root = bread(dp->dev, bmap(dp, 0, 0));
+  de = (struct dirent*)root->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(root);
+    return -1;
+  }
+  for(k = 0; k < 2; k++){
+    bp[k] = bnew(dp->dev, bmap(dp, k+1, 0));
+    h = (struct dxslot*)bp[k]->data;
+    h->w[0] = DXMAGIC;
+    h->w[1] = 1;
+    n[k] = 1;
+  }
+  for(i = DXROOT; i < DPB; i++){
+    if(de[i].inum == 0)
+      continue;
+    k = dxhash(de[i].name) & 1;
+    bde = (struct dirent*)bp[k]->data;
+    bde[n[k]++] = de[i];
+  }
+  memset(&de[DXROOT], 0, BSIZE - DXROOT*sizeof(*de));
+  h = &((struct dxslot*)root->data)[DXROOT];
+  h->w[0] = DXMAGIC;
+  h->w[1] = 1;
+  *dxent(root, 0) = 1;
+  *dxent(root, 1) = 2;
+  for(k = 0; k < 2; k++){
+    log_write(bp[k]);
+    brelse(bp[k]);
+  }
+  log_write(root);
+  brelse(root);
+  dp->size = 3*BSIZE;
+  iupdate(dp);
+  dcachepurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Scan the dirents of linear directory dp from offset off on
+// for name, setting *inum, or for a free one if name is 0.
+// Return the matching dirent's offset, or dp->size if none.
+// Each block is read once and its dirents compared in place.
+static uint
+dirscan(struct inode *dp, char *name, uint off, uint *inum)
+{
+  struct buf *bp;
+  struct dirent *de, *end;
+  uint bn;
+
+  for(; off < dp->size; off = (bn + 1) * BSIZE){
+    // 这里就是从这个inode 里面读取出来里面存的一个个dirent的信息
+    // 这里可以看到其实directory 就是将一个个的底下的目录信息存在data区域而已
+    bn = off / BSIZE;
+    bp = bread(dp->dev, bmap(dp, bn, 0));
+    de = (struct dirent*)(bp->data + off%BSIZE);
+    end = (struct dirent*)(bp->data + min(BSIZE, dp->size - bn*BSIZE));
+    for(; de < end; de++){
+      if(name == 0 ? de->inum == 0 :
+         de->inum != 0 && namecmp(name, de->name) == 0){
+        off = bn*BSIZE + (char*)de - (char*)bp->data;
+        if(inum)
+          *inum = de->inum;
+        brelse(bp);
+        return off;
+      }
+    }
+    brelse(bp);
+  }
+  return dp->size;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  int found;
 
   // 从这里可以看出inode的结构里面, file和directory都是存放在inode里面的,
   // 只是type的标识不一样而已
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    // 这里就是从这个inode 里面读取出来里面存的一个个dirent的信息
-    // 这里可以看到其实directory 就是将一个个的底下的目录信息存在data区域而已
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  found = dcacheget(dp, name, &inum, &off);
+  if(!found && dxindexed(dp)){
+    inum = dxfind(dp, name, &off);
+    dcacheset(dp, name, inum, off);
+    found = 1;
+  }
+  if(found){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
   }
 
-  return 0;
+  off = dirscan(dp, name, 0, &inum);
+  if(off == dp->size){
+    dcacheset(dp, name, 0, 0);
+    return 0;
+  }
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcacheset(dp, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -569,18 +1546,23 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dxindexed(dp)){
+    if((off = dxplace(dp, name)) < 0)
+      return -1;
+  } else {
+    // Look for an empty dirent.
+    off = dirscan(dp, 0, dp->dirfree, 0);
+    dp->dirfree = off + sizeof(de);
+    // Index a directory that has filled its first block.
+    if(off == BSIZE && dxconvert(dp) == 0 && (off = dxplace(dp, name)) < 0)
+      return -1;
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheset(dp, name, inum, off);
   
   return 0;
 }
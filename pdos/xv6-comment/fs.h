@@ -9,7 +9,7 @@
 // Then sb.nlog log blocks.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size; a page, and 8 disk sectors
 
 // File system super block
 struct superblock {
@@ -19,9 +19,37 @@ struct superblock {
   uint nlog;         // Number of log blocks
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A file's blocks are described by extents, runs of blocks
+// contiguous on disk.  The first NEXTENT are in the inode; a
+// larger file keeps them in a tree of blocks, each holding an
+// extenthdr followed by EPB entries.  In the leaves (depth 0)
+// entries are extents; above that, each entry's start is the
+// block holding the node that maps file blocks from lblk on.
+// Blocks are always appended at the end of a file, so the
+// tree only grows along its right edge.
+struct extent {
+  uint lblk;   // first file block
+  uint start;  // first disk block
+  uint len;    // number of blocks; 0 in an index entry
+};
+
+struct extenthdr {
+  ushort n;      // entries in use
+  ushort depth;  // 0 if entries are extents
+};
+
+#define NEXTENT 9
+#define EPB ((BSIZE - sizeof(struct extenthdr)) / sizeof(struct extent))
+#define MAXFILE (0xffffffff / BSIZE)  // size in bytes must fit a uint
+
+// A regular file of at most NINLINE bytes keeps its contents
+// in the inode, where the root of the extent tree would be,
+// and has no data blocks.  Writing past NINLINE moves the
+// contents to a block and the file to extents for good.
+#define NINLINE (sizeof(struct extenthdr) + NEXTENT*sizeof(struct extent))
+
+#define FMT_EXTENTS 0  // contents in blocks mapped by eh, ext
+#define FMT_INLINE  1  // contents in data
 
 // On-disk inode structure
 struct dinode {
@@ -30,7 +58,15 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  short fmt;            // FMT_EXTENTS or FMT_INLINE
+  short pad;
+  union {
+    struct {
+      struct extenthdr eh;  // Root of extent tree
+      struct extent ext[NEXTENT];
+    };
+    char data[NINLINE];
+  };
 };
 
 // Inodes per block.
@@ -53,3 +89,26 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows its first block is indexed: the
+// rest of it is a hash table of bucket blocks, each holding the
+// entries whose names hash to it.  Block 0 keeps "." and ".."
+// and then the index: a header slot giving the table's depth,
+// and the table itself, 1<<depth bucket block numbers, in the
+// slots after it.  Each bucket begins with a header slot giving
+// its own depth, the number of low hash bits its entries share.
+// Every slot has the size of a dirent and an index slot has
+// inum 0, so a program reading the directory as a sequence of
+// dirents, like ls, sees the index as free entries.
+#define DXMAGIC     0x7864  // first word of a header slot
+#define DXROOT      2       // slot of the index header in block 0
+#define DXSLOT      7       // table entries per slot
+#define DXMAXDEPTH  10      // table has at most 1<<DXMAXDEPTH entries
+
+struct dxslot {
+  ushort zero;  // where a dirent's inum is
+  ushort w[DXSLOT];  // header: magic, depth; else table entries
+};
+
@@ -0,0 +1,172 @@
+// File system benchmarks.
+//
+// Each benchmark times itself with uptime() and prints the
+// result in ticks (and a rate), so runs with different CPUS
+// settings or kernel changes can be compared:
+//   $ fsbench          run everything
+//   $ fsbench concread run one benchmark
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+char buf[BSIZE];
+
+// Create path holding nblocks blocks of data.
+void
+mkfile(char *path, int nblocks)
+{
+  int fd, i;
+
+  unlink(path);
+  fd = open(path, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "fsbench: cannot create %s\n", path);
+    exit();
+  }
+  memset(buf, 'a', sizeof(buf));
+  for(i = 0; i < nblocks; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "fsbench: write %s failed\n", path);
+      exit();
+    }
+  }
+  close(fd);
+}
+
+// Read all of path, rounds times.
+void
+readfile(char *path, int rounds)
+{
+  int fd, i;
+
+  for(i = 0; i < rounds; i++){
+    fd = open(path, O_RDONLY);
+    if(fd < 0){
+      printf(1, "fsbench: cannot open %s\n", path);
+      exit();
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+}
+
+// Concurrent reads of a small, fully cached file.
+// Every read() is a bread() of a cached block, so this
+// measures buffer cache lookup scalability: with one
+// cache-wide lock the total time grows with the number
+// of readers instead of staying flat.
+void
+concread(void)
+{
+  enum { NBLK = 16, ROUNDS = 200 };
+  int nproc, i, t0, t;
+
+  printf(1, "concread: %d blocks, %d rounds per reader\n", NBLK, ROUNDS);
+  mkfile("concread", NBLK);
+  readfile("concread", 1);  // warm the cache
+
+  for(nproc = 1; nproc <= 4; nproc *= 2){
+    t0 = uptime();
+    for(i = 0; i < nproc; i++){
+      if(fork() == 0){
+        readfile("concread", ROUNDS);
+        exit();
+      }
+    }
+    for(i = 0; i < nproc; i++)
+      wait();
+    t = uptime() - t0;
+    printf(1, "concread: %d readers %d ticks %d blocks/tick\n",
+           nproc, t, nproc*NBLK*ROUNDS / (t ? t : 1));
+  }
+  unlink("concread");
+}
+
+// Sequential write, then read, of a 1 MB file.  With the
+// block size it decides how many disk requests and cache
+// lookups each KB costs.  The read mostly hits the cache
+// the write left behind.
+void
+seqio(void)
+{
+  enum { NKB = 1024 };
+  int t0, t;
+
+  printf(1, "seqio: %d KB in %d-byte blocks\n", NKB, BSIZE);
+  t0 = uptime();
+  mkfile("seqio", NKB*1024 / BSIZE);
+  t = uptime() - t0;
+  printf(1, "seqio: write %d ticks %d KB/tick\n", t, NKB / (t ? t : 1));
+
+  t0 = uptime();
+  readfile("seqio", 1);
+  t = uptime() - t0;
+  printf(1, "seqio: read %d ticks %d KB/tick\n", t, NKB / (t ? t : 1));
+  unlink("seqio");
+}
+
+// Large sequential write() calls, which filewrite() splits
+// into many log transactions.  Reports MB/s, to a tenth,
+// at 100 ticks a second.
+char bigbuf[64*1024];
+
+void
+bigwrite(void)
+{
+  enum { NKB = 1024 };
+  int fd, i, t0, t, r;
+
+  printf(1, "bigwrite: %d KB in %d-byte writes\n", NKB, sizeof(bigbuf));
+  unlink("bigwrite");
+  memset(bigbuf, 'b', sizeof(bigbuf));
+  t0 = uptime();
+  fd = open("bigwrite", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "fsbench: cannot create bigwrite\n");
+    exit();
+  }
+  for(i = 0; i < NKB*1024 / sizeof(bigbuf); i++){
+    if(write(fd, bigbuf, sizeof(bigbuf)) != sizeof(bigbuf)){
+      printf(1, "fsbench: write bigwrite failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  t = uptime() - t0;
+  if(t == 0)
+    t = 1;
+  r = NKB * 100 * 10 / 1024 / t;
+  printf(1, "bigwrite: %d ticks %d.%d MB/s\n", t, r / 10, r % 10);
+  unlink("bigwrite");
+}
+
+struct bench {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "concread", concread },
+  { "seqio", seqio },
+  { "bigwrite", bigwrite },
+};
+
+int
+main(int argc, char *argv[])
+{
+  int i, j;
+
+  for(i = 0; i < sizeof(benches)/sizeof(benches[0]); i++){
+    if(argc > 1){
+      for(j = 1; j < argc; j++)
+        if(strcmp(argv[j], benches[i].name) == 0)
+          break;
+      if(j == argc)
+        continue;
+    }
+    benches[i].fn();
+  }
+  exit();
+}
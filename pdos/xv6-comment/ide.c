@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.  Moves data with PCI bus-master DMA when
+// the controller supports it, else with PIO (in/out
+// instructions).  Build with make IDEPIO=1 to always use PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -9,26 +11,95 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "pci.h"
+
+#define SECTOR_SIZE   512
+#define SPB           (BSIZE/SECTOR_SIZE)  // sectors per block
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_IDENTIFY 0xec
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master DMA registers of the primary channel,
+// at offsets from bmbase.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDE_MAXRUN    128  // max sectors per command
+#define IDE_MAXWAIT   20   // ticks before a request may no longer be passed
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+//
+// idestart() sends one command for the run of queued bufs
+// holding consecutive blocks at the head of idequeue.  The
+// disk interrupts once per idemult sectors; ideleft counts
+// the run's sectors not yet completed, and idesect those of
+// idequeue's buf already done.
+//
+// Behind the running command, idequeue is kept in C-LOOK
+// order: blocks above the head position idepos in ascending
+// order, then the ones below it, again ascending, for the
+// next sweep.  A request queued IDE_MAXWAIT ticks ago is no
+// longer passed by new ones.  Build with make IDEFIFO=1 to
+// get plain first-come first-served order for comparison.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idemult;
+static int ideleft;
+static int idesect;
+static uint idepos;
+
+// Request statistics, printed and reset by idedump().
+static struct {
+  uint nreq;     // requests completed
+  uint wait;     // their total ticks from queue to completion
+  uint maxwait;
+  uint ncmd;     // commands issued
+  uint seek;     // total blocks the head moved between commands
+} idestat;
 
 static int havedisk1;
+static int multmax[2];  // sectors per READ/WRITE MULTIPLE block
+static int dmaok[2];    // disk can do DMA
 static void idestart(struct buf*);
 
+// Physical region descriptor: one physically contiguous
+// piece of a DMA transfer.  The table must not cross a
+// 64KB boundary, hence the alignment.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last entry in table
+
+static struct prd prdt[IDE_MAXRUN] __attribute__((aligned(1024)));
+static ushort bmbase;  // bus-master registers; 0 if no DMA
+static int idedma;     // running command uses DMA
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -42,6 +113,51 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk dev whether it can do DMA and how many sectors
+// it can move per interrupt, and turn on multiple mode if
+// it can do more than one.
+static void
+ideidentify(int dev)
+{
+  ushort id[256];
+  int m;
+
+  outb(0x3f6, 2);  // no interrupts
+  outb(0x1f6, 0xe0 | (dev<<4));
+  outb(0x1f7, IDE_CMD_IDENTIFY);
+  if(idewait(1) < 0 || (inb(0x1f7) & IDE_DRQ) == 0)
+    return;
+  insl(0x1f0, id, SECTOR_SIZE/4);
+
+  dmaok[dev] = (id[49] & (1<<8)) != 0;
+  m = id[47] & 0xff;  // max sectors per block
+  if(m <= 1)
+    return;
+  if(m > IDE_MAXRUN)
+    m = IDE_MAXRUN;
+  outb(0x1f2, m);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  if(idewait(1) >= 0)
+    multmax[dev] = m;
+}
+
+// Find the IDE controller on the PCI bus and
+// enable its bus-master DMA engine.
+static void
+idedmainit(void)
+{
+#ifndef IDE_PIO
+  struct pcidev d;
+
+  if(!pcifind(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d))
+    return;
+  if((d.bar[4] & 1) == 0)  // not in I/O space
+    return;
+  pciwrite(&d, PCI_CMD, pciread(&d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+  bmbase = d.bar[4] & ~3;
+#endif
+}
+
 void
 ideinit(void)
 {
@@ -61,29 +177,103 @@ ideinit(void)
     }
   }
   
+  idedmainit();
+  ideidentify(0);
+  if(havedisk1)
+    ideidentify(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Position of b on the disks, for ordering requests.
+static uint
+idekey(struct buf *b)
+{
+  return ((b->dev&1)<<28) | b->blockno;
+}
+
+// Copy the running command's next n sectors to the disk,
+// starting idesect sectors into idequeue.
+static void
+ideput(int n)
+{
+  struct buf *b;
+  int s;
+
+  for(b = idequeue, s = idesect; n > 0; n--){
+    outsl(0x1f0, b->data + s*SECTOR_SIZE, SECTOR_SIZE/4);
+    if(++s == SPB){
+      s = 0;
+      b = b->qnext;
+    }
+  }
+}
+
+// Start the request for b and the bufs after it in
+// idequeue that continue it: same disk, same direction,
+// next block.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p, *q;
+  int i, n, dev, write, sector;
+
   if(b == 0)
     panic("idestart");
 
+  dev = b->dev & 1;
+  write = b->flags & B_DIRTY;
+  n = 1;
+  for(p = b; n < IDE_MAXRUN/SPB && (q = p->qnext) != 0; p = q){
+    if(q->dev != b->dev || (q->flags & B_DIRTY) != write ||
+       q->blockno != p->blockno + 1)
+      break;
+    n++;
+  }
+  sector = b->blockno * SPB;
+  idestat.ncmd++;
+  idestat.seek += idekey(b) > idepos ? idekey(b) - idepos : idepos - idekey(b);
+  idepos = idekey(p);
+  n *= SPB;  // from here on, n counts sectors
+  ideleft = n;
+  idesect = 0;
+  idemult = 1;
+  if(n > 1 && multmax[dev] > 1)
+    idemult = multmax[dev];
+
+  // With DMA the disk moves the data of all the bufs itself,
+  // and interrupts once at the end.
+  idedma = bmbase && dmaok[dev];
+  if(idedma){
+    for(i = 0, q = b; i < n/SPB; i++, q = q->qnext){
+      prdt[i].addr = v2p(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[i-1].flags = PRD_EOT;
+    idemult = n;
+    outl(bmbase+BM_PRDT, v2p(prdt));
+    outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);  // clear
+    outb(bmbase+BM_CMD, write ? 0 : BM_CMD_READ);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, n);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | (dev<<4) | ((sector>>24)&0x0f));
+  if(idedma){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase+BM_CMD, inb(bmbase+BM_CMD) | BM_CMD_START);
+  } else if(write){
+    outb(0x1f7, idemult > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    idewait(0);
+    ideput(idemult < n ? idemult : n);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idemult > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
@@ -92,6 +282,8 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int i, n, ok;
+  uint w;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -100,30 +292,94 @@ ideintr(void)
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // This interrupt finishes the command's next n sectors:
+  // for a read, their data is ready; for a write, it is on disk.
+  n = idemult < ideleft ? idemult : ideleft;
+  if(idedma){
+    // Stop the DMA engine and acknowledge its interrupt.
+    outb(bmbase+BM_CMD, 0);
+    outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    idewait(0);
+    ok = 0;  // data is already in b->data
+  } else
+    ok = (b->flags & B_DIRTY) || idewait(1) >= 0;
+  for(i = 0; i < n; i++){
+    b = idequeue;
+
+    // Read data if needed.
+    if(!(b->flags & B_DIRTY) && ok)
+      insl(0x1f0, b->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+    if(++idesect < SPB)
+      continue;
+    idesect = 0;
+    idequeue = b->qnext;
   
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
+    // Wake process waiting for this buf.
+    // biodone may release b, so leave it alone afterwards.
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_IO);
+    w = ticks - b->qtime;
+    idestat.nreq++;
+    idestat.wait += w;
+    if(w > idestat.maxwait)
+      idestat.maxwait = w;
+    wakeup(b);
+    biodone(b);
+  }
+  ideleft -= n;
+
+  if(ideleft > 0){
+    // Command still running; a write needs its next block.
+    if(idequeue->flags & B_DIRTY)
+      ideput(idemult < ideleft ? idemult : ideleft);
+  } else if(idequeue != 0){
+    // Start disk on next buf in queue.
     idestart(idequeue);
+  }
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Return the link in idequeue where b should go.
+static struct buf**
+ideplace(struct buf *b)
+{
+  struct buf **pp;
+#ifdef IDE_FIFO
+  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+    ;
+#else
+  struct buf **start, *q;
+  int i, up, qup;
+
+  // Skip the running command and every request
+  // that has waited too long to be passed.
+  pp = &idequeue;
+  for(i = 0; i < (idesect + ideleft)/SPB && *pp; i++)
+    pp = &(*pp)->qnext;
+  for(start = pp; *pp; pp = &(*pp)->qnext)
+    if(ticks - (*pp)->qtime >= IDE_MAXWAIT)
+      start = &(*pp)->qnext;
+
+  // Find b's place in the sweep.
+  up = idekey(b) > idepos;
+  for(pp = start; (q = *pp) != 0; pp = &q->qnext){
+    qup = idekey(q) > idepos;
+    if(up && !qup)
+      break;
+    if(up == qup && idekey(q) > idekey(b))
+      break;
+  }
+#endif
+  return pp;
+}
+
+// Add b to idequeue, starting the disk if it is idle.
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b)
 {
   struct buf **pp;
 
@@ -134,17 +390,26 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+  b->flags |= B_IO;
+  b->qtime = ticks;
+  pp = ideplace(b);
+  b->qnext = *pp;
   *pp = b;
   
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
+}
+
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);  //DOC:acquire-lock
+
+  ideappend(b);
   
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
@@ -153,3 +418,39 @@ iderw(struct buf *b)
 
   release(&idelock);
 }
+
+// Like iderw, but return as soon as b is queued.
+// The caller must not touch b until iderw_wait(b) returns
+// or b->iodone is called.
+void
+iderw_async(struct buf *b)
+{
+  acquire(&idelock);
+  ideappend(b);
+  release(&idelock);
+}
+
+// Wait for a request queued by iderw_async to finish.
+// Returns at once if none is in progress.
+void
+iderw_wait(struct buf *b)
+{
+  acquire(&idelock);
+  while(b->flags & B_IO)
+    sleep(b, &idelock);
+  release(&idelock);
+}
+
+// Print request statistics gathered since the last call,
+// then reset them.  Called on ^T from the console.
+void
+idedump(void)
+{
+  acquire(&idelock);
+  cprintf("ide: %d requests, avg wait %d ticks, max %d; %d commands, avg seek %d\n",
+          idestat.nreq, idestat.nreq ? idestat.wait/idestat.nreq : 0,
+          idestat.maxwait, idestat.ncmd,
+          idestat.ncmd ? idestat.seek/idestat.ncmd : 0);
+  memset(&idestat, 0, sizeof(idestat));
+  release(&idelock);
+}
@@ -79,3 +79,18 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Like ioapicenable, for a PCI interrupt line, which is
+// level-triggered and active low; and deliver it at the
+// given vector, so that the device can share the handler
+// of a fixed ISA one.  Without an I/O APIC, the caller
+// must use the PIC instead; see piclevel().
+void
+ioapicroute(int irq, int vector, int cpunum)
+{
+  if(!ismp)
+    return;
+
+  ioapicwrite(REG_TABLE+2*irq, INT_LEVEL | INT_ACTIVELOW | vector);
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
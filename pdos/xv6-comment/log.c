@@ -1,6 +1,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "fs.h"
 #include "buf.h"
@@ -17,112 +18,311 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the commit thread has taken the transaction.
+//
+// Commits are done by a kernel thread, not by end_op().
+// It lets a transaction gather system calls for LOGDELAY
+// ticks (group commit), then freezes it: it stops new
+// system calls, waits for running ones to finish, and copies
+// the transaction's blocks.  The next transaction opens
+// right away, in the second in-memory header, while the
+// copies are written to the log and then home.  The buffers
+// themselves are free meanwhile, so a large write() that
+// keeps changing the same inode and bitmap blocks fills the
+// next transaction while the last one is on its way to disk.
+// A system call's updates therefore reach the disk shortly
+// after it returns, not before.
 //
 // The log is a physical re-do log containing disk blocks.
+// Its size comes from the superblock's nlog.
 // The on-disk log format:
-//   header block, containing sector #s for block A, B, C, ...
+//   header blocks, containing a count n, a sequence number,
+//     a checksum, then sector #s for block A, B, C, ...;
+//     as many blocks as needed
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// commit() queues the header and all of a transaction's log
+// blocks at once and waits for them together.  The checksum
+// covers the header and the blocks, so recovery can tell a
+// complete commit from a torn one.  The header is not cleared
+// after the blocks are installed: until the next commit
+// replaces it, replaying it only rewrites the same data.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged sector #s before commit.
+// Contents of the header blocks, used to keep track in memory
+// of logged sector #s before commit.  On disk, n, seq and sum
+// are followed directly by the sector #s.
 struct logheader {
   int n;   
-  int sector[LOGSIZE]; // 所以这里的sector 记录的不是
+  uint seq;
+  uint sum;
+  int *sector; // log.cap entries
+  struct buf **page; // page cache buf of each block, or 0
 };
 
 struct log {
   struct spinlock lock;
   int start; // 这里的start 是第几个block的意思, 所以每+1 就是block + 1
   int size;
+  int nhead;       // header blocks at start
+  int cap;         // data blocks after them
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int freezing;    // commit thread is freezing lh, please wait.
+  uint opened;     // ticks when lh got its first block
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // open transaction
+  struct logheader clh;  // frozen transaction being committed
+  ushort *hash;          // sector -> index in lh.sector, for absorption
+  uint hmask;
+  uchar **copy;          // contents of clh's blocks, a page each
+  struct buf **wbuf;     // for writing copy[] to the log and home
+  uint seq;              // of the last transaction committed
 };
 struct log log;
 
+#define NASYNC 8  // log blocks in flight at once during recovery
+
+// All per-block arrays must fit in a page.
+#define LOGMAX  (PGSIZE/sizeof(int) - 1)
+#define HEMPTY  0xffff
+
+#define WPB  ((int)(BSIZE/sizeof(int)))  // header words per block
+#define HWORDS 3  // n, seq, sum
+
+// Header blocks needed for a transaction of n blocks.
+#define HEADBLOCKS(n)  (((n)+HWORDS + WPB-1) / WPB)
+
 static void recover_from_log(void);
-static void commit();
+static void committer(void);
+static int logfull(void);
+
+// Allocate n bytes, at most a page, of log memory.
+// It is never freed.
+static void*
+logalloc(int n)
+{
+  static char *p;
+  static int left;
+  void *v;
+
+  n = (n + 3) & ~3;
+  if (n > left) {
+    if ((p = kalloc()) == 0)
+      panic("initlog: out of memory");
+    left = PGSIZE;
+  }
+  v = p;
+  p += n;
+  left -= n;
+  return v;
+}
 
 void
 initlog(void)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   struct superblock sb;
+  int i;
+
   initlock(&log.lock, "log");
   readsb(ROOTDEV, &sb);
   log.start = sb.size - sb.nlog;
   log.size = sb.nlog;
   log.dev = ROOTDEV;
+
+  // Split the log into header and data blocks.
+  log.cap = log.size - 1;
+  while (log.cap > 0 && HEADBLOCKS(log.cap) + log.cap > log.size)
+    log.cap--;
+  if (log.cap > LOGMAX)
+    log.cap = LOGMAX;
+  if (log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.nhead = HEADBLOCKS(log.cap);
+
+  log.lh.sector = logalloc(log.cap * sizeof(int));
+  log.clh.sector = logalloc(log.cap * sizeof(int));
+  log.lh.page = logalloc(log.cap * sizeof(struct buf*));
+  log.clh.page = logalloc(log.cap * sizeof(struct buf*));
+  for (log.hmask = 1; log.hmask < 2*log.cap; log.hmask <<= 1)
+    ;
+  log.hash = logalloc(log.hmask * sizeof(ushort));
+  memset(log.hash, 0xff, log.hmask * sizeof(ushort));
+  log.hmask--;
+  log.copy = logalloc(log.cap * sizeof(uchar*));
+  for (i = 0; i < log.cap; i++)
+    if ((log.copy[i] = (uchar*)kalloc()) == 0)
+      panic("initlog: out of memory");
+  log.wbuf = logalloc(log.cap * sizeof(struct buf*));
+  for (i = 0; i < log.cap; i++) {
+    log.wbuf[i] = logalloc(sizeof(struct buf));
+    memset(log.wbuf[i], 0, sizeof(struct buf));
+  }
+
   recover_from_log();
+  kthread("commit", committer);
+}
+
+// Index of sector in the open transaction, or -1.
+// Caller must hold log.lock.
+static int
+logfind(uint sector)
+{
+  uint h;
+
+  for (h = sector & log.hmask; log.hash[h] != HEMPTY; h = (h+1) & log.hmask)
+    if (log.lh.sector[log.hash[h]] == sector)
+      return log.hash[h];
+  return -1;
 }
 
 // Copy committed blocks from log to their home location
+// during recovery.
 static void 
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf); 
-    brelse(dbuf);
+  struct buf *lbuf[NASYNC], *dbuf[NASYNC];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > NASYNC)
+      n = NASYNC;
+    for (i = 0; i < n; i++) {
+      lbuf[i] = bread_async(log.dev, log.start+log.nhead+tail+i); // read log block
+      dbuf[i] = bread_async(log.dev, log.lh.sector[tail+i]); // read dst
+    }
+    for (i = 0; i < n; i++) {
+      bwait(lbuf[i]);
+      bwait(dbuf[i]);
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+      bwrite_async(dbuf[i]);  // write dst to disk
+      brelse(lbuf[i]);
+    }
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
+// Add n bytes at p to checksum sum (FNV-1a, by words).
+static uint
+logsum(uint sum, void *p, int n)
+{
+  uint *w;
+
+  for (w = p; n > 0; n -= sizeof(uint))
+    sum = (sum ^ *w++) * 16777619;
+  return sum;
+}
+
+// Checksum of header h; the blocks are added to it.
+static uint
+headsum(struct logheader *h)
+{
+  uint sum;
+
+  sum = 2166136261;
+  sum = logsum(sum, &h->n, sizeof(h->n));
+  sum = logsum(sum, &h->seq, sizeof(h->seq));
+  return logsum(sum, h->sector, h->n * sizeof(int));
+}
+
 // Read the log header from disk into the in-memory log header
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct buf *buf;
+  int *w;
+  int b, k, i;
+
+  for (b = 0; b < log.nhead; b++) {
+    buf = bread(log.dev, log.start+b);
+    w = (int*)buf->data;
+    for (k = 0; k < WPB; k++) {
+      i = b*WPB + k - HWORDS;
+      if (i == -3) {
+        // Check n before storing any sectors: lh.sector has
+        // room for only log.cap of them.
+        log.lh.n = w[k];
+        if (log.lh.n < 0 || log.lh.n > log.cap)
+          log.lh.n = 0;  // garbage; nothing to recover
+      } else if (i == -2)
+        log.lh.seq = w[k];
+      else if (i == -1)
+        log.lh.sum = w[k];
+      else if (i < log.lh.n)
+        log.lh.sector[i] = w[k];
+    }
+    brelse(buf);
+  }
+}
+
+// Is the transaction in log.lh complete on disk?
+static int
+log_intact(void)
+{
+  struct buf *buf;
+  uint sum;
   int i;
-  log.lh.n = lh->n;
+
+  sum = headsum(&log.lh);
   for (i = 0; i < log.lh.n; i++) {
-    log.lh.sector[i] = lh->sector[i];
+    buf = bread(log.dev, log.start+log.nhead+i);
+    sum = logsum(sum, buf->data, BSIZE);
+    brelse(buf);
   }
-  brelse(buf);
+  return sum == log.lh.sum;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write in-memory log header h to disk.
+// Once it and the log blocks it lists are on disk, the
+// transaction is committed.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   // 这里可以看到 logheader 是存在log.start 的这个Block的位置, 
   // 然后接下来才是真正的log data数据
   // 这里是把这个数据从log里面拷出来, 然后hb指针指向的是这个第一个block的位置,
   // 也就是logheader的位置
   // 然后这个全局的Log拷贝给这个hb指针, 也就是logheader 的位置, 然后写入到磁盘
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->sector[i] = log.lh.sector[i];
+  struct buf *hb[HEADBLOCKS(LOGMAX)];
+  int *w;
+  int b, k, i;
+
+  for (b = 0; b < HEADBLOCKS(h->n); b++) {
+    hb[b] = bread(log.dev, log.start+b);
+    w = (int*)hb[b]->data;
+    for (k = 0; k < WPB; k++) {
+      i = b*WPB + k - HWORDS;
+      if (i == -3)
+        w[k] = h->n;
+      else if (i == -2)
+        w[k] = h->seq;
+      else if (i == -1)
+        w[k] = h->sum;
+      else if (i < h->n)
+        w[k] = h->sector[i];
+    }
+    bwrite_async(hb[b]);
+  }
+  for (b = 0; b < HEADBLOCKS(h->n); b++) {
+    bwait(hb[b]);
+    brelse(hb[b]);
   }
-  bwrite(buf);
-  brelse(buf);
 }
 
 static void
 recover_from_log(void)
 {
   read_head();      
+  if (log.lh.n > 0 && !log_intact())
+    log.lh.n = 0;  // torn commit; it never happened
   install_trans(); // if committed, copy from log to disk
+  log.seq = log.lh.seq;
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -131,9 +331,9 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if (log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE) {
+    } else if (logfull()) {
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -145,64 +345,112 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The commit thread commits the transaction later.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space.
-    wakeup(&log);
-  }
+  // The commit thread may be waiting for the last
+  // operation, and begin_op() for log space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
+// Would one more operation exhaust the open transaction's
+// log space?  Caller must hold log.lock.
+static int
+logfull(void)
+{
+  return log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.cap;
 }
 
-// Copy modified blocks from cache to log.
-static void 
-write_log(void)
+// Copy the frozen transaction's blocks, so that the next
+// transaction may change the buffers while these are written.
+// The buffers stay B_DIRTY, and so in the cache, until home.
+static void
+copy_trans(void)
 {
-  int tail;
+  struct buf *b;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    // 这里的log.start 是log block 的位置
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+  for (i = 0; i < log.clh.n; i++) {
     // 这里为什么bread 一定读的是cache block呢,
     // 因为到了log.lh.sector[tail]里面记录的block肯定是被修改过的,
-    // 所以被修改过的block信息一定是放在buffer cache里面的, 所以这里是将buffer
-    // cache 里面的数据写入到具体的log data block 里面
-    struct buf *from = bread(log.dev, log.lh.sector[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from); 
-    brelse(to);
+    // 所以被修改过的block信息一定是放在buffer cache里面的, 所以这里
+    // 直接把buffer cache 里面的block 拷贝出来, 写入到具体的log data block 里面
+    if ((b = log.clh.page[i]) != 0) {
+      memmove(log.copy[i], b->data, BSIZE);  // page cache page
+      continue;
+    }
+    b = bread(log.dev, log.clh.sector[i]); // cache block
+    memmove(log.copy[i], b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Start writing the copies of the frozen transaction's
+// blocks, to the log if tolog is set, else home.
+static void 
+write_copies(int tolog)
+{
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log.clh.n; i++) {
+    b = log.wbuf[i];
+    b->dev = log.dev;
+    b->blockno = tolog ? log.start+log.nhead+i : log.clh.sector[i];
+    b->data = log.copy[i];
+    b->flags = B_BUSY | B_VALID | B_DIRTY;
+    iderw_async(b);
+  }
+}
+
+// Write the copies home.  Then the cache may evict each
+// buffer or page, unless the open transaction has changed
+// it since.
+static void
+install_copies(void)
+{
+  struct buf *b;
+  int i, k;
+
+  write_copies(0);
+  for (i = 0; i < log.clh.n; i++)
+    iderw_wait(log.wbuf[i]);
+  for (i = 0; i < log.clh.n; i++) {
+    if ((b = log.clh.page[i]) != 0) {
+      acquire(&log.lock);
+      k = logfind(log.clh.sector[i]);
+      if (k < 0 || log.lh.page[k] != b)
+        pcclean(b);
+      release(&log.lock);
+      continue;
+    }
+    b = bread(log.dev, log.clh.sector[i]);
+    acquire(&log.lock);
+    k = logfind(b->blockno);
+    if (k < 0 || log.lh.page[k] != 0)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
   }
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    // write_log 做的事情就是将在transaction中修改过的block 写入到log block
+  int i;
+
+  if (log.clh.n > 0) {
+    log.clh.seq = ++log.seq;
+    log.clh.sum = headsum(&log.clh);
+    for (i = 0; i < log.clh.n; i++)
+      log.clh.sum = logsum(log.clh.sum, log.copy[i], BSIZE);
+    // write_copies(1) 做的事情就是将在transaction中修改过的block 写入到log block
     // 里面去, 具体写入的是log block 最后面的 logged block
-    write_log();     // Write modified blocks from cache to log
+    write_copies(1);  // Write copied blocks to log
     // 然后将log block 里面的head 数据先写入到disk
     // 也就是Log结构里面的logheader 这一部分的数据, 标记log.lh.n字段,
     // 表示要写入的数据块的个数, 如果log.lh.n == 0,
@@ -220,22 +468,63 @@ commit()
     // 如果没写这个logheader之前就crash了, 那么其实没影响,
     // 因为logheader并没有记录需要拷贝的信息, 也就是没有设置这个log.lh.n 信息
     // 这部分log data数据直接清空了
-    write_head();    // Write header to disk -- the real commit
-    // install_trans 是将写在磁盘里面的log_block里面的数据写到磁盘具体的位置
-    install_trans(); // Now install writes to home locations
-    // 写完以后这里直接将这个log header的信息改成0, 那么后续的所有logged
-    // block里面的数据就没用了, 因为在写真正数据块的时候是看这个logheader
-    // 里面有多少的block的
-    log.lh.n = 0; 
-    // 这一步主要就是更新log.lh.n = 0, 那么后面的log block 的数据不用管了,
-    // 读到log.lh.n == 0, 就知道后面的数据是没用的了
-    write_head();    // Erase the transaction from the log
+    write_head(&log.clh); // Write header to disk -- the real commit
+    for (i = 0; i < log.clh.n; i++)
+      iderw_wait(log.wbuf[i]);
+    // install_copies 是将已经写入log的数据写到磁盘具体的位置
+    install_copies(); // Now install writes to home locations
+    // The header stays; the next commit overwrites it.
+    log.clh.n = 0; 
+  }
+}
+
+// The commit thread.
+static void
+committer(void)
+{
+  int *p;
+  struct buf **q;
+
+  for(;;){
+    acquire(&log.lock);
+    while(log.lh.n == 0)
+      sleep(&log, &log.lock);
+
+    // Group commit: let more operations join the transaction,
+    // unless one is already waiting for log space.
+    while(ticks - log.opened < LOGDELAY && !logfull())
+      sleep(&ticks, &log.lock);
+
+    // Freeze: hold off new operations, wait for running
+    // ones, then take the transaction and copy its blocks.
+    log.freezing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    p = log.clh.sector;
+    q = log.clh.page;
+    log.clh = log.lh;
+    log.lh.sector = p;
+    log.lh.page = q;
+    log.lh.n = 0;
+    memset(log.hash, 0xff, (log.hmask+1) * sizeof(ushort));
+    release(&log.lock);
+
+    copy_trans();
+
+    // The next transaction can open now.
+    acquire(&log.lock);
+    log.freezing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit();
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// The commit thread will do the disk write.  b may be a page
+// cache page (B_PAGE), which is then pinned the same way.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -249,23 +538,45 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct buf *pg;
+  uint h;
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
+  acquire(&log.lock);
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  // 这里是先查看一下是否有某一个sector 已经被修改过了, 否则就找到最大的那个,
+  // 这里是先查看一下是否有某一个sector 已经被修改过了, 否则就加到最后面,
   // 标记成DIRTY
-  
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.sector[i] == b->sector)   // log absorbtion
-      break;
-  }
-  log.lh.sector[i] = b->sector;
-  if (i == log.lh.n)
-    log.lh.n++;
+  pg = (b->flags & B_PAGE) ? b : 0;
+  if ((i = logfind(b->blockno)) < 0) {   // log absorbtion
+    if (log.lh.n >= log.cap)
+      panic("too big a transaction");
+    if (log.lh.n == 0)
+      log.opened = ticks;
+    for (h = b->blockno & log.hmask; log.hash[h] != HEMPTY; h = (h+1) & log.hmask)
+      ;
+    log.hash[h] = log.lh.n;
+    log.lh.page[log.lh.n] = pg;
+    log.lh.sector[log.lh.n++] = b->blockno;
+  } else if (log.lh.page[i] != pg)
+    panic("log_write: block changed hands");
   b->flags |= B_DIRTY; // prevent eviction
+  release(&log.lock);
+}
+
+// Is blockno part of the open transaction?  balloc() skips
+// such a block: freed and allocated again in one transaction,
+// it could move between the buffer cache and the page cache,
+// and the log records only one of them.
+int
+log_holds(uint blockno)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = logfind(blockno) >= 0;
+  release(&log.lock);
+  return r;
 }
 
@@ -29,7 +29,6 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
   iinit();         // inode cache
   ideinit();       // disk
@@ -37,6 +36,8 @@ main(void)
     timerinit();   // uniprocessor timer
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache; sized from free memory
+  pcinit();        // page cache; sized from what is left
   userinit();      // first user process
   // Finish setting up this processor in mpmain.
   mpmain();
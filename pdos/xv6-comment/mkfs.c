@@ -13,14 +13,14 @@
 
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 
-int nblocks = (995-LOGSIZE);
+int nblocks;  // whatever the rest leave of size
 int nlog = LOGSIZE;
 int ninodes = 200;
-int size = 1024;
+int size = FSSIZE;
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -33,6 +33,10 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *de, int n);
+
+struct dirent *rootde;  // root directory, written last
+int nrootde;
 
 // convert to intel byte order
 ushort
@@ -61,10 +65,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
-  char buf[512];
-  struct dinode din;
+  uint rootino, inum;
+  struct dirent *de;
+  char buf[BSIZE];
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -74,8 +77,8 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -83,15 +86,16 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  bitblocks = size/(BSIZE*8) + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
+
   sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
+  sb.nblocks = xint(nblocks); // so whole disk is size blocks
   sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
 
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
-
   printf("used %d (bit %d ninode %zu) free %u log %u total %d\n", usedblocks,
          bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
 
@@ -104,18 +108,17 @@ main(int argc, char *argv[])
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
 
+  rootde = calloc(ninodes + 1, sizeof(*rootde));
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootde[nrootde++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, ".");
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootde[nrootde++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, "..");
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -134,10 +137,9 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    de = &rootde[nrootde++];
+    de->inum = xshort(inum);
+    strncpy(de->name, argv[i], DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -145,12 +147,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootde, nrootde);
 
   balloc(usedblocks);
 
@@ -160,11 +157,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (off_t)BSIZE, 0) != sec * (off_t)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -179,7 +176,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -193,7 +190,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -206,11 +203,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (off_t)BSIZE, 0) != sec * (off_t)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -224,6 +221,7 @@ ialloc(ushort type)
 
   bzero(&din, sizeof(din));
   din.type = xshort(type);
+  din.fmt = xshort(type == T_FILE ? FMT_INLINE : FMT_EXTENTS);
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -233,61 +231,150 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
+  printf("balloc: write bitmap block at block %zu\n", ninodes/IPB + 3);
   wsect(ninodes / IPB + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Must match dxhash() in fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Write the n entries de, the first "." and "..", as the
+// contents of directory inum: a single block if they fit,
+// else an indexed directory with a table just deep enough
+// that no bucket overflows.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  char buf[BSIZE];
+  struct dirent *bde;
+  struct dxslot *s;
+  int i, j, k, depth, nb, fill[1 << DXMAXDEPTH];
+
+  if(n <= DPB){
+    bzero(buf, BSIZE);
+    memmove(buf, de, n*sizeof(*de));
+    iappend(inum, buf, BSIZE);
+    return;
+  }
+
+  for(depth = 1; ; depth++){
+    assert(depth <= DXMAXDEPTH);
+    nb = 1 << depth;
+    bzero(fill, sizeof(fill));
+    for(i = 2; i < n; i++)
+      if(++fill[dxhash(de[i].name) & (nb-1)] > DPB - 1)
+        break;
+    if(i == n)
+      break;
+  }
+
+  bzero(buf, BSIZE);
+  memmove(buf, de, 2*sizeof(*de));
+  s = (struct dxslot*)buf;
+  s[DXROOT].w[0] = xshort(DXMAGIC);
+  s[DXROOT].w[1] = xshort(depth);
+  for(k = 0; k < nb; k++)
+    s[DXROOT+1 + k/DXSLOT].w[k%DXSLOT] = xshort(k + 1);
+  iappend(inum, buf, BSIZE);
+
+  for(k = 0; k < nb; k++){
+    bzero(buf, BSIZE);
+    s[0].w[0] = xshort(DXMAGIC);
+    s[0].w[1] = xshort(depth);
+    bde = (struct dirent*)buf;
+    for(i = 2, j = 1; i < n; i++)
+      if((dxhash(de[i].name) & (nb-1)) == k)
+        bde[j++] = de[i];
+    iappend(inum, buf, BSIZE);
+  }
+}
+
+// Return the disk block holding file block fbn of din,
+// appending a new block to the file if fbn is just past its end.
+// mkfs only makes files small enough for the extents in the inode.
+uint
+fmap(struct dinode *din, uint fbn)
+{
+  struct extent *e;
+  int i, n;
+
+  n = xshort(din->eh.n);
+  assert(xshort(din->eh.depth) == 0);
+  for(i = 0; i < n; i++){
+    e = &din->ext[i];
+    if(fbn >= xint(e->lblk) && fbn < xint(e->lblk) + xint(e->len))
+      return xint(e->start) + fbn - xint(e->lblk);
+  }
+  e = n > 0 ? &din->ext[n-1] : 0;
+  if(e && xint(e->start) + xint(e->len) == freeblock){
+    assert(fbn == xint(e->lblk) + xint(e->len));
+    e->len = xint(xint(e->len) + 1);
+  } else {
+    assert(n < NEXTENT);
+    e = &din->ext[n];
+    e->lblk = xint(fbn);
+    e->start = xint(freeblock);
+    e->len = xint(1);
+    din->eh.n = xshort(n + 1);
+  }
+  usedblocks++;
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
+  char buf[BSIZE];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
-  while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+  if(xshort(din.fmt) == FMT_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    // Too big to stay inline; move what there is to a block.
+    bzero(buf, BSIZE);
+    bcopy(din.data, buf, off);
+    bzero(din.data, NINLINE);
+    din.fmt = xshort(FMT_EXTENTS);
+    if(off > 0)
+      wsect(fmap(&din, 0), buf);
+  }
+  while(n > 0){
+    fbn = off / BSIZE;
+    x = fmap(&din, fbn);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -0,0 +1,10 @@
+// mmap() protections and flags.
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_SHARED  0x01  // stores reach the file
+#define MAP_PRIVATE 0x02  // stores stay in this process
+#define MAP_ANON    0x04  // zero-filled memory, no file
+
+#define MAP_FAILED  ((void*)-1)
@@ -0,0 +1,401 @@
+// Memory-mapped files and anonymous memory.
+//
+// mmap() records a region in proc->vma and maps nothing;
+// pages come in on demand, when trap() sees a page fault in
+// the region and calls vmafault().
+//
+// A file page is the page cache page itself (pcache.c), held
+// for as long as it is mapped and marked PTE_PC in the page
+// table.  A shared mapping maps it writable if asked, and
+// the processor's dirty bit (PTE_D) tells msync() and
+// munmap() which pages to send through the log.  A private
+// mapping maps it read-only; the first store copies it into
+// a page of the process's own.  Anonymous memory is private
+// zero-filled pages.
+//
+// The kernel itself never page faults on a mapping: argptr(),
+// argwptr() and fetchint() fault a system call's arguments in
+// before the call uses them, through vmacheck(), and
+// fetchstr() through vmastr(), which takes strings only from
+// anonymous memory.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "stat.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "page.h"
+#include "mman.h"
+
+// The mapping holding address va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va - v->addr < v->len)
+      return v;
+  return 0;
+}
+
+// Page number within the file of address va in v.
+static uint
+vmapn(struct vma *v, uint va)
+{
+  return (v->off + (va - v->addr)) / PGSIZE;
+}
+
+// Lowest address mapped by p, or KERNBASE.
+// The heap may not grow past it.
+uint
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = KERNBASE;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of f from offset off, or anonymous memory
+// if flags has MAP_ANON, at an address of the kernel's
+// choosing.  Returns the address, or -1.
+int
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v, *w;
+  uint a;
+  int share;
+
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(len == 0 || len > KERNBASE || off % PGSIZE != 0)
+    return -1;
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  if(flags & MAP_ANON){
+    if(share == MAP_SHARED)
+      return -1;  // would need pages shared across fork
+    f = 0;
+  } else {
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if(share == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    if(imappable(f->ip) < 0)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+
+  for(v = proc->vma; v < &proc->vma[NVMA]; v++)
+    if(v->len == 0)
+      break;
+  if(v == &proc->vma[NVMA])
+    return -1;
+
+  // Take the highest gap that fits.
+  a = KERNBASE - len;
+again:
+  for(w = proc->vma; w < &proc->vma[NVMA]; w++){
+    if(w->len && a < w->addr + w->len && w->addr < a + len){
+      if(w->addr < len)
+        return -1;
+      a = w->addr - len;
+      goto again;
+    }
+  }
+  if(a < PGROUNDUP(proc->sz))
+    return -1;
+
+  v->addr = a;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  return a;
+}
+
+// Make the page holding va in v present, for a store if
+// write is set.  Returns -1 if v doesn't allow the access,
+// the page is past the end of the file, or memory is short.
+static int
+vmfill(struct vma *v, uint va, int write)
+{
+  pte_t *pte;
+  struct page *pg;
+  char *mem;
+  int perm;
+
+  if(!(v->prot & PROT_READ) || (write && !(v->prot & PROT_WRITE)))
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(proc->pgdir, (char*)va, 1)) == 0)
+    return -1;
+
+  if(*pte & PTE_P){
+    if(!write || (*pte & PTE_W))
+      return 0;
+    // First store to a private mapping of a cached page.
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, p2v(PTE_ADDR(*pte)), PGSIZE);
+    pcput(pcheld(v->f->ip->dev, v->f->ip->inum, vmapn(v, va)));
+    *pte = v2p(mem) | PTE_P | PTE_W | PTE_U;
+    lcr3(v2p(proc->pgdir));  // flush the old translation
+    return 0;
+  }
+
+  perm = (v->prot & PROT_WRITE) ? PTE_W|PTE_U : PTE_U;
+  if(v->f == 0){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    *pte = v2p(mem) | PTE_P | perm;
+    return 0;
+  }
+
+  if((pg = pagei(v->f->ip, vmapn(v, va))) == 0)
+    return -1;
+  if(v->flags & MAP_SHARED){
+    *pte = v2p(pg->b.data) | PTE_P | PTE_PC | perm;
+    return 0;
+  }
+  if(!write){
+    *pte = v2p(pg->b.data) | PTE_P | PTE_PC | PTE_U;
+    return 0;
+  }
+  if((mem = kalloc()) == 0){
+    pcput(pg);
+    return -1;
+  }
+  memmove(mem, pg->b.data, PGSIZE);
+  pcput(pg);
+  *pte = v2p(mem) | PTE_P | perm;
+  return 0;
+}
+
+// Called by trap() on a page fault at va in user space.
+// Returns 0 if the fault was handled and the process can
+// go on, or -1 if the address was bad.
+int
+vmafault(uint va, uint err)
+{
+  struct vma *v;
+
+  if((v = vmafind(proc, va)) == 0)
+    return -1;
+  return vmfill(v, va, err & FEC_WR);
+}
+
+// Check that [va, va+n) lies in one mapping that allows
+// the access, and fault its pages in.  For argptr().
+int
+vmacheck(uint va, uint n, int write)
+{
+  struct vma *v;
+  uint a;
+
+  if(va + n < va || (v = vmafind(proc, va)) == 0 || va + n > v->addr + v->len)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(vmfill(v, a, write) < 0)
+      return -1;
+  return 0;
+}
+
+// Check that a nul-terminated string starts at va in
+// anonymous memory, faulting its pages in, and return its
+// length, or -1.  For fetchstr().  The kernel uses the string
+// in place, and only this process can store to its anonymous
+// memory, so the nul stays put; a file's page could lose it
+// to a write() or another process's mapping at any time.
+int
+vmastr(uint va)
+{
+  struct vma *v;
+  char *s;
+
+  for(s = (char*)va; ; s++){
+    if(s == (char*)va || (uint)s % PGSIZE == 0)
+      if((v = vmafind(proc, (uint)s)) == 0 || v->f || vmfill(v, (uint)s, 0) < 0)
+        return -1;
+    if(*s == 0)
+      return s - (char*)va;
+  }
+}
+
+// Write the pages of shared mapping v in [a, end) that have
+// been stored to since the last time to the file, through
+// the log.  A transaction takes at most MAXOPBLOCKS of them.
+static void
+vmsync(struct vma *v, uint a, uint end)
+{
+  struct inode *ip;
+  struct page *pg;
+  pte_t *pte;
+  int n;
+
+  if(!(v->prot & PROT_WRITE))
+    return;
+  ip = v->f->ip;
+  for(;;){
+    for(; a < end; a += PGSIZE){
+      pte = walkpgdir(proc->pgdir, (char*)a, 0);
+      if(pte && (*pte & (PTE_P|PTE_D)) == (PTE_P|PTE_D))
+        break;
+    }
+    if(a >= end)
+      break;
+    begin_op();
+    ilock(ip);
+    for(n = 0; a < end && n < MAXOPBLOCKS; a += PGSIZE){
+      pte = walkpgdir(proc->pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+        continue;
+      pg = pcheld(ip->dev, ip->inum, vmapn(v, a));
+      log_write(&pg->b);
+      *pte &= ~PTE_D;
+      n++;
+    }
+    iunlock(ip);
+    end_op();
+  }
+  lcr3(v2p(proc->pgdir));  // so the next store sets PTE_D again
+}
+
+// Unmap [a, end) of v, writing back a shared mapping first.
+static void
+vmunmap(struct vma *v, uint a, uint end)
+{
+  pte_t *pte;
+
+  if(v->flags & MAP_SHARED)
+    vmsync(v, a, end);
+  for(; a < end; a += PGSIZE){
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P))
+      continue;
+    if(*pte & PTE_PC)
+      pcput(pcheld(v->f->ip->dev, v->f->ip->inum, vmapn(v, a)));
+    else
+      kfree(p2v(PTE_ADDR(*pte)));
+    *pte = 0;
+  }
+  lcr3(v2p(proc->pgdir));
+}
+
+// Unmap [addr, addr+len), which must be all, or the start or
+// end, of one mapping.
+int
+munmap(uint addr, uint len)
+{
+  struct vma *v;
+  uint end;
+
+  if(addr % PGSIZE != 0 || len == 0 || (v = vmafind(proc, addr)) == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if(end < addr || end > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && end != v->addr + v->len)
+    return -1;
+
+  vmunmap(v, addr, end);
+  if(addr == v->addr){
+    v->off += end - addr;
+    v->addr = end;
+  }
+  v->len -= end - addr;
+  if(v->len == 0 && v->f){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Write back the pages of a shared mapping in
+// [addr, addr+len) that have been stored to.
+int
+msync(uint addr, uint len)
+{
+  struct vma *v;
+  uint end;
+
+  if(addr % PGSIZE != 0 || (v = vmafind(proc, addr)) == 0)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if(end < addr || end > v->addr + v->len)
+    return -1;
+  if(v->flags & MAP_SHARED)
+    vmsync(v, addr, end);
+  return 0;
+}
+
+// Unmap everything; for exec() and exit().
+void
+munmapall(void)
+{
+  struct vma *v;
+
+  for(v = proc->vma; v < &proc->vma[NVMA]; v++)
+    if(v->len)
+      munmap(v->addr, v->len);
+}
+
+// Give child np the mappings of the current process.
+// Pages a private mapping has stored to are the parent's
+// own, so the child gets copies; the child faults in the
+// rest itself, sharing the page cache's.
+int
+vmafork(struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint a;
+  char *mem;
+
+  memset(np->vma, 0, sizeof(np->vma));
+  for(v = proc->vma, nv = np->vma; v < &proc->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    if(v->f)
+      nv->f = filedup(v->f);
+    if(v->flags & MAP_SHARED)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      pte = walkpgdir(proc->pgdir, (char*)a, 0);
+      if(pte == 0 || !(*pte & PTE_P) || (*pte & PTE_PC))
+        continue;
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, p2v(PTE_ADDR(*pte)), PGSIZE);
+      if(mappages(np->pgdir, (char*)a, PGSIZE, v2p(mem), *pte & (PTE_W|PTE_U)) < 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+  return 0;
+
+bad:
+  // The copies go with np->pgdir.
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->f)
+      fileclose(nv->f);
+    nv->f = 0;
+    nv->len = 0;
+  }
+  return -1;
+}
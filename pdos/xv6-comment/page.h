@@ -0,0 +1,11 @@
+// A page of file data in the page cache; see pcache.c.
+struct page {
+  uint dev;
+  uint inum;          // 0 once the file no longer has this page
+  uint pn;            // page number within the file
+  int ref;            // holders; a held page is not recycled
+  struct buf b;       // for disk I/O and the log; b.data is the page
+  struct page *hnext; // hash chain
+  struct page *prev;  // LRU list
+  struct page *next;
+};
@@ -2,12 +2,21 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mmap()ed regions per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      500  // maximum number of cached i-nodes
+#define NDCACHE     512  // directory entries cached for name lookup
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NDISK         2  // disks that may hold a file system (dev 0, 1)
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data sectors in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define FSSIZE      640  // size of file system in blocks (kernelmemfs embeds it)
+#define LOGSIZE      (MAXOPBLOCKS*6)  // size of on-disk log made by mkfs
+#define LOGDELAY     1  // ticks a transaction waits for more ops before commit
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define BCACHEPCT    25  // % of free memory the disk block cache may grow to
+#define PCACHEPCT    25  // % of free memory the file page cache may grow to
+#define NPCACHE      (MAXOPBLOCKS*3)  // pages the file page cache never shrinks below
+#define RAMAX        32  // max blocks read ahead of a sequential reader
 
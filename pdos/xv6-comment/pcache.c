@@ -0,0 +1,371 @@
+// Page cache.
+//
+// File data is cached in whole pages named by (dev, inum,
+// page number within the file), apart from the buffer cache,
+// which is left to metadata: inodes, bitmaps, directories
+// and extent tree nodes.  readi() and writei() copy between
+// these pages and the caller, so exec's loaduvm(), which
+// reads through readi(), shares them with read().
+//
+// Each page holds a struct buf whose data is the page, with
+// B_PAGE set and B_BUSY always set, so the disk driver can
+// read into it and log_write() can take it.  As in the buffer
+// cache, B_DIRTY means the log has not yet written the page
+// home, and such a page stays in the cache; the log calls
+// pcclean() when it is done.
+//
+// The contents of a file's pages are protected by the
+// inode's lock, held by whoever fills or changes them.
+// pcache.lock protects the rest: the hash chains, the LRU
+// list, ref and inum.
+//
+// The cache starts with NPCACHE pages and grows a page at a
+// time up to PCACHEPCT percent of memory, then recycles the
+// least recently used idle page.  Pages held by mmap() may
+// push it past that for a while.  kalloc() calls pcshrink()
+// when it runs out of pages, which gives back idle pages but
+// never the first NPCACHE, so reads still work when user
+// memory has taken everything else.  pcget() returns 0 if
+// even those are all in use.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+#include "page.h"
+
+#if BSIZE != PGSIZE
+#error "the page cache needs a block per page"
+#endif
+
+#define NPHASH 1021  // hash chains
+
+struct {
+  struct spinlock lock;
+  struct page *hash[NPHASH];
+  struct page lru;        // lru.next is most recently used
+  struct page *freehdr;   // unused page headers, through next
+  int npage;              // pages in the cache
+  int maxpage;            // don't grow beyond this many
+  int reserve;            // don't grow if fewer free pages than this
+} pcache;
+
+static struct page *pgrow(int);
+static void pfront(struct page*);
+
+void
+pcinit(void)
+{
+  struct page *pg;
+  int n;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.prev = &pcache.lru;
+  pcache.lru.next = &pcache.lru;
+  n = kfreepages();
+  pcache.maxpage = n / 100 * PCACHEPCT;
+  if(pcache.maxpage < NPCACHE)
+    pcache.maxpage = NPCACHE;
+  pcache.reserve = n / 16;
+
+  // Start with NPCACHE idle, unnamed pages.
+  while(pcache.npage < NPCACHE){
+    if((pg = pgrow(1)) == 0)
+      panic("pcinit");
+    acquire(&pcache.lock);
+    pg->next = pg->prev = pg;
+    pfront(pg);
+    release(&pcache.lock);
+  }
+}
+
+static struct page**
+phash(uint dev, uint inum, uint pn)
+{
+  return &pcache.hash[(dev*31 + inum*17 + pn) % NPHASH];
+}
+
+// Take pg off its hash chain, if it is on one.
+// Caller must hold pcache.lock.
+static void
+punhash(struct page *pg)
+{
+  struct page **pp;
+
+  if(pg->inum == 0)
+    return;
+  for(pp = phash(pg->dev, pg->inum, pg->pn); *pp != pg; pp = &(*pp)->hnext)
+    ;
+  *pp = pg->hnext;
+  pg->inum = 0;
+}
+
+// Move pg to the front of the LRU list.
+// Caller must hold pcache.lock.
+static void
+pfront(struct page *pg)
+{
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+  pg->next = pcache.lru.next;
+  pg->prev = &pcache.lru;
+  pcache.lru.next->prev = pg;
+  pcache.lru.next = pg;
+}
+
+// Free pg, which is off its hash chain, idle and clean.
+// Caller must hold pcache.lock.
+static void
+pfree(struct page *pg)
+{
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+  kfree((char*)pg->b.data);
+  pg->next = pcache.freehdr;
+  pcache.freehdr = pg;
+  pcache.npage--;
+}
+
+// pg is off its hash chain, idle and clean: free it, or
+// keep it on the LRU list for reuse if the cache is down
+// to NPCACHE pages.
+// Caller must hold pcache.lock.
+static void
+pdone(struct page *pg)
+{
+  if(pcache.npage > NPCACHE)
+    pfree(pg);
+}
+
+// Is pg neither held, nor waiting for the log, nor being read?
+static int
+pidle(struct page *pg)
+{
+  return pg->ref == 0 && (pg->b.flags & (B_DIRTY|B_IO)) == 0;
+}
+
+// Least recently used idle page, or 0.
+// Caller must hold pcache.lock.
+static struct page*
+plru(void)
+{
+  struct page *pg;
+
+  for(pg = pcache.lru.prev; pg != &pcache.lru; pg = pg->prev)
+    if(pidle(pg))
+      return pg;
+  return 0;
+}
+
+// Add a new page to the cache, unnamed and off the LRU list.
+// Returns 0 if memory is short or, unless over is set, the
+// cache is at its size limit.
+static struct page*
+pgrow(int over)
+{
+  struct page *pg;
+  char *data, *p;
+
+  acquire(&pcache.lock);
+  if(!over && (pcache.npage >= pcache.maxpage || kfreepages() < pcache.reserve)){
+    release(&pcache.lock);
+    return 0;
+  }
+  pcache.npage++;
+  release(&pcache.lock);
+
+  data = kalloc();
+  acquire(&pcache.lock);
+  if(data && pcache.freehdr == 0){
+    // Carve a fresh page into headers; these are never freed.
+    release(&pcache.lock);
+    p = kalloc();
+    acquire(&pcache.lock);
+    if(p == 0){
+      kfree(data);
+      data = 0;
+    }
+    for(pg = (struct page*)p; p && pg+1 <= (struct page*)(p+PGSIZE); pg++){
+      pg->next = pcache.freehdr;
+      pcache.freehdr = pg;
+    }
+  }
+  if(data == 0){
+    pcache.npage--;
+    release(&pcache.lock);
+    return 0;
+  }
+  pg = pcache.freehdr;
+  pcache.freehdr = pg->next;
+  release(&pcache.lock);
+  memset(pg, 0, sizeof(*pg));
+  pg->b.data = (uchar*)data;
+  return pg;
+}
+
+// Return page pn of file (dev, inum), held, or 0 if every
+// page is in use and memory is exhausted.
+// If it was not cached, its contents are not valid:
+// B_VALID is clear in its buf, and the caller fills it in.
+struct page*
+pcget(uint dev, uint inum, uint pn)
+{
+  struct page *pg, *npg, **pp;
+
+  npg = 0;
+  acquire(&pcache.lock);
+ loop:
+  for(pg = *phash(dev, inum, pn); pg != 0; pg = pg->hnext){
+    if(pg->dev == dev && pg->inum == inum && pg->pn == pn){
+      if(npg){
+        // Lost a race; keep the new page, idle.
+        npg->next = pcache.lru.prev->next;
+        npg->prev = pcache.lru.prev;
+        pcache.lru.prev->next = npg;
+        pcache.lru.prev = npg;
+      }
+      pg->ref++;
+      pfront(pg);
+      release(&pcache.lock);
+      return pg;
+    }
+  }
+
+  if(npg == 0){
+    release(&pcache.lock);
+    npg = pgrow(0);
+    acquire(&pcache.lock);
+    if(npg == 0 && (npg = plru()) != 0){
+      punhash(npg);
+      npg->next->prev = npg->prev;
+      npg->prev->next = npg->next;
+    }
+    if(npg == 0){
+      // Every page is held, say by mappings; go over
+      // the limit rather than wait for one.
+      release(&pcache.lock);
+      if((npg = pgrow(1)) == 0)
+        return 0;
+      acquire(&pcache.lock);
+    }
+    goto loop;
+  }
+
+  pg = npg;
+  pg->dev = dev;
+  pg->inum = inum;
+  pg->pn = pn;
+  pg->ref = 1;
+  pg->b.dev = dev;
+  pg->b.flags = B_BUSY | B_PAGE;
+  pg->b.iodone = 0;
+  pp = phash(dev, inum, pn);
+  pg->hnext = *pp;
+  *pp = pg;
+  pg->next = pg->prev = pg;
+  pfront(pg);
+  release(&pcache.lock);
+  return pg;
+}
+
+// Let go of a page returned by pcget().
+void
+pcput(struct page *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->ref < 1)
+    panic("pcput");
+  pg->ref--;
+  if(pg->inum == 0 && pidle(pg))
+    pdone(pg);
+  release(&pcache.lock);
+}
+
+// Return page pn of file (dev, inum), which the caller
+// already holds, say through a mapping; for pcput().
+struct page*
+pcheld(uint dev, uint inum, uint pn)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  for(pg = *phash(dev, inum, pn); pg != 0; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pn == pn)
+      break;
+  release(&pcache.lock);
+  if(pg == 0 || pg->ref < 1)
+    panic("pcheld");
+  return pg;
+}
+
+// Forget pages 0 through n-1 of file (dev, inum), whose
+// blocks are being freed.  A page still held or still on its
+// way to the disk is freed later by pcput() or pcclean().
+// Caller must hold the inode's lock, so no new reads start.
+void
+pcdrop(uint dev, uint inum, uint n)
+{
+  struct page *pg;
+  uint pn;
+
+  for(pn = 0; pn < n; pn++){
+    acquire(&pcache.lock);
+    for(pg = *phash(dev, inum, pn); pg != 0; pg = pg->hnext)
+      if(pg->dev == dev && pg->inum == inum && pg->pn == pn)
+        break;
+    if(pg == 0){
+      release(&pcache.lock);
+      continue;
+    }
+    pg->ref++;
+    release(&pcache.lock);
+
+    iderw_wait(&pg->b);  // a read-ahead may be in flight
+
+    acquire(&pcache.lock);
+    pg->ref--;
+    punhash(pg);
+    if(pidle(pg))
+      pdone(pg);
+    release(&pcache.lock);
+  }
+}
+
+// Called by the log when the page in b is home and no
+// transaction has changed it since.
+void
+pcclean(struct buf *b)
+{
+  struct page *pg;
+
+  pg = (struct page*)((char*)b - (uint)&((struct page*)0)->b);
+  acquire(&pcache.lock);
+  b->flags &= ~B_DIRTY;
+  if(pg->inum == 0 && pidle(pg))
+    pdone(pg);
+  release(&pcache.lock);
+}
+
+// Give one idle page back to kalloc(), keeping NPCACHE.
+// Called by kalloc() when it runs out of memory.
+// Returns 1 if a page was freed.
+int
+pcshrink(void)
+{
+  struct page *pg;
+
+  if(pcache.maxpage == 0)
+    return 0;  // pcinit() hasn't run yet
+  acquire(&pcache.lock);
+  if(pcache.npage <= NPCACHE || (pg = plru()) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  punhash(pg);
+  pfree(pg);
+  release(&pcache.lock);
+  return 1;
+}
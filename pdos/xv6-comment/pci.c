@@ -0,0 +1,81 @@
+// PCI bus enumeration, using configuration mechanism #1:
+// write the address of a configuration register to port
+// 0xcf8, then read or write its value at port 0xcfc.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR 0xcf8
+#define PCI_CONFDATA 0xcfc
+
+static uint
+pciaddr(struct pcidev *d, int off)
+{
+  return 0x80000000 | (d->bus<<16) | (d->dev<<11) | (d->func<<8) | (off&0xfc);
+}
+
+// Read the 32-bit configuration register at off.
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, pciaddr(d, off));
+  return inl(PCI_CONFDATA);
+}
+
+// Write the 32-bit configuration register at off.
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, pciaddr(d, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first function whose configuration register at
+// off, masked with mask, equals val, and fill in *d.
+// Returns 0 if there is none.
+static int
+pcilookup(int off, uint mask, uint val, struct pcidev *d)
+{
+  uint id;
+  int i;
+
+  for(d->bus = 0; d->bus < 256; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      for(d->func = 0; d->func < 8; d->func++){
+        id = pciread(d, PCI_ID);
+        if((id & 0xffff) == 0xffff){
+          if(d->func == 0)
+            break;  // no device here
+          continue;
+        }
+        if((pciread(d, off) & mask) == val){
+          d->vendor = id & 0xffff;
+          d->device = id >> 16;
+          for(i = 0; i < 6; i++)
+            d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+          d->irq = pciread(d, PCI_INTR) & 0xff;
+          return 1;
+        }
+        if(d->func == 0 && (pciread(d, PCI_HEADER) & 0x800000) == 0)
+          break;  // single-function device
+      }
+    }
+  }
+  return 0;
+}
+
+// Find the first function with the given class and subclass.
+int
+pcifind(int class, int subclass, struct pcidev *d)
+{
+  return pcilookup(PCI_CLASS, 0xffff0000, (class<<24) | (subclass<<16), d);
+}
+
+// Find the first function with the given vendor and device IDs.
+int
+pcifindid(int vendor, int device, struct pcidev *d)
+{
+  return pcilookup(PCI_ID, 0xffffffff, (device<<16) | vendor, d);
+}
@@ -0,0 +1,25 @@
+// PCI configuration space.
+
+#define PCI_ID        0x00  // vendor and device
+#define PCI_CMD       0x04  // command and status
+#define PCI_CLASS     0x08  // class, subclass, prog-if, revision
+#define PCI_HEADER    0x0c  // header type in bits 16-23
+#define PCI_BAR0      0x10  // six base address registers
+#define PCI_INTR      0x3c  // interrupt line in bits 0-7
+
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // allow bus mastering
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uint bar[6];
+  uchar irq;
+};
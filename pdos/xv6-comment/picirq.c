@@ -10,6 +10,11 @@
 
 #define IRQ_SLAVE       2       // IRQ at which slave connects to master
 
+// Edge/level control registers of PIIX-style chipsets, as
+// QEMU has: a set bit makes that IRQ level-triggered.
+#define IO_ELCR1        0x4D0   // IRQs 0-7
+#define IO_ELCR2        0x4D1   // IRQs 8-15
+
 // Current IRQ mask.
 // Initial IRQ mask has interrupt 2 enabled (for slave 8259A).
 static ushort irqmask = 0xFFFF & ~(1<<IRQ_SLAVE);
@@ -28,6 +33,18 @@ picenable(int irq)
   picsetmask(irqmask & ~(1<<irq));
 }
 
+// Enable irq as a level-triggered line, as a PCI
+// interrupt routed to the PIC is.
+void
+piclevel(int irq)
+{
+  if(irq < 8)
+    outb(IO_ELCR1, inb(IO_ELCR1) | (1 << irq));
+  else
+    outb(IO_ELCR2, inb(IO_ELCR2) | (1 << (irq - 8)));
+  picenable(irq);
+}
+
 // Initialize the 8259A interrupt controllers.
 void
 picinit(void)
@@ -76,6 +76,29 @@ found:
   return p;
 }
 
+// Start a kernel thread named name that runs fn, which must
+// never return.  It has the kernel's address space and no
+// user memory.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread: no proc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory");
+  // forkret returns to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->sz = 0;
+  p->parent = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -114,6 +137,8 @@ growproc(int n)
   
   sz = proc->sz;
   if(n > 0){
+    if(sz + n < sz || sz + n > vmabase(proc))
+      return -1;  // would run into a mapping
     if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -145,6 +170,14 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(vmafork(np) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = proc->sz;
   np->parent = proc;
   *np->tf = *proc->tf;
@@ -188,6 +221,9 @@ exit(void)
   if(proc == initproc)
     panic("init exiting");
 
+  // Unmap mmap()ed regions, writing back shared ones.
+  munmapall();
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(proc->ofile[fd]){
@@ -51,6 +51,16 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region mapped by mmap(); see mmap.c.
+struct vma {
+  uint addr;         // first address, page aligned
+  uint len;          // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;          // PROT_READ, PROT_WRITE
+  int flags;         // MAP_SHARED or MAP_PRIVATE, maybe MAP_ANON
+  struct file *f;    // mapped file, or 0 if anonymous
+  uint off;          // offset in f of addr
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -65,6 +75,7 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // mmap()ed regions
   char name[16];               // Process name (debugging)
 };
 
@@ -73,3 +84,4 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+// with mmap()ed regions above, allocated down from KERNBASE.
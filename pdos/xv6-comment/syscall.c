@@ -13,12 +13,14 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
-// Fetch the int at addr from the current process.
+// Fetch the int at addr from the current process,
+// from its memory or an mmap()ed region.
 int
 fetchint(uint addr, int *ip)
 {
   if(addr >= proc->sz || addr+4 > proc->sz)
-    return -1;
+    if(vmacheck(addr, 4, 0) < 0)
+      return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -26,14 +28,16 @@ fetchint(uint addr, int *ip)
 // Fetch the nul-terminated string at addr from the current process.
 // Doesn't actually copy the string - just sets *pp to point at it.
 // Returns length of string, not including nul.
+// Past the process's memory, the string must be in
+// anonymous mmap()ed memory; see vmastr().
 int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
 
-  if(addr >= proc->sz)
-    return -1;
   *pp = (char*)addr;
+  if(addr >= proc->sz)
+    return vmastr(addr);
   ep = (char*)proc->sz;
   for(s = *pp; s < ep; s++)
     if(*s == 0)
@@ -50,7 +54,8 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size n bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space: its memory, or one
+// mmap()ed region, whose pages are faulted in now.
 int
 argptr(int n, char **pp, int size)
 {
@@ -59,15 +64,32 @@ argptr(int n, char **pp, int size)
   if(argint(n, &i) < 0)
     return -1;
   if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+    if(size < 0 || vmacheck(i, size, 0) < 0)
+      return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, for memory the kernel will store to.
+int
+argwptr(int n, char **pp, int size)
+{
+  int i;
+  
+  if(argint(n, &i) < 0)
     return -1;
+  if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+    if(size < 0 || vmacheck(i, size, 1) < 0)
+      return -1;
   *pp = (char*)i;
   return 0;
 }
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Only the process itself can store to its memory or its
+// anonymous mappings, so the string can't change between this
+// check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -98,6 +120,9 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -121,6 +146,9 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_msync]   sys_msync,
 };
 
 void
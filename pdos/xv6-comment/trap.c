@@ -13,6 +13,7 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+int ideirq = IRQ_IDE;   // disk's interrupt line; see virtio.c
 
 void
 tvinit(void)
@@ -77,9 +78,19 @@ trap(struct trapframe *tf)
             cpu->id, tf->cs, tf->eip);
     lapiceoi();
     break;
+  case T_PGFLT:
+    // Maybe a page of an mmap()ed region not yet present.
+    if(proc && (tf->cs&3) == DPL_USER && vmafault(rcr2(), tf->err) == 0)
+      break;
+    // Else a bad address.
    
   //PAGEBREAK: 13
   default:
+    if(tf->trapno == T_IRQ0 + ideirq){
+      // A PCI disk interrupt through the PIC.
+      ideintr();
+      break;
+    }
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
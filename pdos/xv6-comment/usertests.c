@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -184,6 +185,8 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+#define NBIG 200  // blocks in writetest1's file
+
 void
 writetest1(void)
 {
@@ -197,9 +200,9 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
-    if(write(fd, buf, 512) != 512){
+    if(write(fd, buf, BSIZE) != BSIZE){
       printf(stdout, "error: write big file failed\n", i);
       exit();
     }
@@ -215,14 +218,14 @@ writetest1(void)
 
   n = 0;
   for(;;){
-    i = read(fd, buf, 512);
+    i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NBIG - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
       break;
-    } else if(i != 512){
+    } else if(i != BSIZE){
       printf(stdout, "read failed %d\n", i);
       exit();
     }
@@ -892,8 +895,9 @@ linkunlink()
 void
 bigdir(void)
 {
-  int i, fd;
+  int i, fd, n;
   char name[10];
+  struct dirent de;
 
   printf(1, "bigdir test\n");
   unlink("bd");
@@ -916,6 +920,19 @@ bigdir(void)
     }
   }
 
+  // The directory is indexed by now, but should still
+  // read as plain dirents.
+  fd = open(".", 0);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0 && de.name[0] == 'x' && strlen(de.name) == 3)
+      n++;
+  close(fd);
+  if(n != 500){
+    printf(1, "bigdir read %d entries\n", n);
+    exit();
+  }
+
   unlink("bd");
   for(i = 0; i < 500; i++){
     name[0] = 'x';
@@ -1200,6 +1217,315 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// two files written a block at a time in turn, so that
+// neither is contiguous on disk and each needs many extents.
+void
+fragfile(void)
+{
+  int fd[2], i, j, n;
+
+  printf(1, "fragfile test\n");
+
+  for(j = 0; j < 2; j++){
+    name[0] = 'f';
+    name[1] = 'a' + j;
+    name[2] = 0;
+    fd[j] = open(name, O_CREATE | O_RDWR);
+    if(fd[j] < 0){
+      printf(1, "cannot create fragfile\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 100; i++){
+    for(j = 0; j < 2; j++){
+      memset(buf, 0, BSIZE);
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf(1, "write fragfile failed\n");
+        exit();
+      }
+    }
+  }
+  for(j = 0; j < 2; j++){
+    close(fd[j]);
+    name[1] = 'a' + j;
+    fd[j] = open(name, 0);
+    if(fd[j] < 0){
+      printf(1, "cannot open fragfile\n");
+      exit();
+    }
+    for(i = 0; (n = read(fd[j], buf, BSIZE)) == BSIZE; i++){
+      if(((int*)buf)[0] != i || ((int*)buf)[1] != j){
+        printf(1, "read fragfile wrong data\n");
+        exit();
+      }
+    }
+    if(n != 0 || i != 100){
+      printf(1, "read fragfile wrong total\n");
+      exit();
+    }
+    close(fd[j]);
+    if(unlink(name) < 0){
+      printf(1, "unlink fragfile failed\n");
+      exit();
+    }
+  }
+
+  printf(1, "fragfile test ok\n");
+}
+
+// a file small enough to live in its inode, then grown
+// past that so its contents must move to a block.
+void
+inlinefile(void)
+{
+  int fd, i, n;
+
+  printf(1, "inlinefile test\n");
+
+  for(i = 0; i < 300; i++)
+    buf[i] = 'a' + i%26;
+  fd = open("inl", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, buf, 100) != 100){
+    printf(1, "write inlinefile failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inl", O_RDWR);
+  n = read(fd, buf+300, 300);
+  for(i = 0; i < n; i++)
+    if(buf[300+i] != buf[i])
+      break;
+  if(n != 100 || i != n){
+    printf(1, "read inlinefile wrong data\n");
+    exit();
+  }
+  if(write(fd, buf+100, 200) != 200){
+    printf(1, "grow inlinefile failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inl", 0);
+  n = read(fd, buf+300, 300);
+  close(fd);
+  for(i = 0; i < n; i++)
+    if(buf[300+i] != buf[i])
+      break;
+  if(n != 300 || i != n){
+    printf(1, "read grown inlinefile wrong data\n");
+    exit();
+  }
+  unlink("inl");
+
+  printf(1, "inlinefile test ok\n");
+}
+
+#define MMAPSZ (2*4096 + 100)  // mmaptest's file: two pages and a bit
+#define MMAPC(i) ('a' + (i)/7%26)
+
+// private, shared and anonymous mappings, across fork
+void
+mmaptest(void)
+{
+  int fd, i, n, pid, fds[2];
+  char *p, *q, *a;
+
+  printf(1, "mmap test\n");
+
+  fd = open("mmapfile", O_CREATE | O_RDWR);
+  for(i = 0; i < MMAPSZ; i += n){
+    n = MMAPSZ - i < 4096 ? MMAPSZ - i : 4096;
+    for(p = buf; p < buf + n; p++)
+      *p = MMAPC(i + (p - buf));
+    if(write(fd, buf, n) != n){
+      printf(1, "write mmapfile failed\n");
+      exit();
+    }
+  }
+
+  p = mmap(0, MMAPSZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  q = mmap(0, MMAPSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf(1, "mmap failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < MMAPSZ; i++)
+    if(p[i] != MMAPC(i) || q[i] != MMAPC(i))
+      break;
+  if(i != MMAPSZ){
+    printf(1, "mmap wrong data at %d\n", i);
+    exit();
+  }
+
+  // Private stores stay private; shared ones reach the file.
+  p[0] = 'X';
+  q[1] = 'Y';
+  q[8200] = 'Z';
+  if(q[0] != MMAPC(0) || p[1] != MMAPC(1) || msync(q, MMAPSZ) < 0){
+    printf(1, "mmap private store leaked\n");
+    exit();
+  }
+  fd = open("mmapfile", 0);
+  if(read(fd, buf, 8192) != 8192 || read(fd, buf+8192, 100) != 100 ||
+     buf[0] != MMAPC(0) || buf[1] != 'Y' || buf[8200-4096] != 'Z'){
+    printf(1, "msync didn't reach the file\n");
+    exit();
+  }
+  close(fd);
+
+  // read() into a private mapping, write() from a shared one.
+  fd = open("mmapfile", 0);
+  if(read(fd, p+4096, 10) != 10 || p[4097] != 'Y' || p[0] != 'X'){
+    printf(1, "read into mmap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapcopy", O_CREATE | O_RDWR);
+  if(write(fd, q, MMAPSZ) != MMAPSZ){
+    printf(1, "write from mmap failed\n");
+    exit();
+  }
+  close(fd);
+
+  // A path in a file's pages could change under the kernel.
+  strcpy(p + 100, "mmapfile");
+  if(open(p + 100, 0) >= 0){
+    printf(1, "open of path in file mapping succeeded\n");
+    exit();
+  }
+  if(munmap(p, MMAPSZ) < 0 || munmap(q, MMAPSZ) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+
+  // Anonymous memory is zeroed, and copied by fork.
+  a = mmap(0, 3*4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if(a == MAP_FAILED || a[0] != 0 || a[3*4096-1] != 0){
+    printf(1, "mmap anon failed\n");
+    exit();
+  }
+  a[5000] = 'A';
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Tell the parent by writing a byte only if all is well.
+    close(fds[0]);
+    if(a[5000] == 'A'){
+      a[5000] = 'B';
+      write(fds[1], "x", 1);
+    }
+    exit();
+  }
+  close(fds[1]);
+  n = read(fds[0], buf, 1);
+  close(fds[0]);
+  wait();
+  if(n != 1){
+    printf(1, "mmap anon not inherited\n");
+    exit();
+  }
+  if(a[5000] != 'A'){
+    printf(1, "mmap anon shared with child\n");
+    exit();
+  }
+  // A path in mapped memory, across a page boundary.
+  strcpy(a + 4096 - 4, "mmapfile");
+  fd = open(a + 4096 - 4, 0);
+  if(fd < 0){
+    printf(1, "open of mmap path failed\n");
+    exit();
+  }
+  close(fd);
+  munmap(a, 3*4096);
+
+  // A file small enough to live in its inode.
+  fd = open("mmapsmall", O_CREATE | O_RDWR);
+  if(write(fd, "tiny", 4) != 4){
+    printf(1, "write mmapsmall failed\n");
+    exit();
+  }
+  q = mmap(0, 4, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(q == MAP_FAILED || q[0] != 't' || q[3] != 'y'){
+    printf(1, "mmap of small file failed\n");
+    exit();
+  }
+  close(fd);
+  q[1] = 'o';
+  fd = open("mmapsmall", 0);
+  if(munmap(q, 4) < 0 || read(fd, buf, 10) != 4 || buf[1] != 'o'){
+    printf(1, "mmap store to small file lost\n");
+    exit();
+  }
+  close(fd);
+
+  unlink("mmapfile");
+  unlink("mmapcopy");
+  unlink("mmapsmall");
+  printf(1, "mmap test ok\n");
+}
+
+#define NSTREAM 192  // buf-sized writes in bigstream's file (1.5 MB)
+
+// write and read back a file of several megabytes,
+// reporting how fast each went.
+void
+bigstream(void)
+{
+  int fd, i, n, t;
+
+  printf(1, "bigstream test\n");
+
+  unlink("bigstream");
+  fd = open("bigstream", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create bigstream\n");
+    exit();
+  }
+  t = uptime();
+  for(i = 0; i < NSTREAM; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "write bigstream failed at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  t = uptime() - t;
+  printf(1, "bigstream: wrote %d KB in %d ticks\n", NSTREAM*sizeof(buf)/1024, t);
+
+  fd = open("bigstream", 0);
+  if(fd < 0){
+    printf(1, "cannot open bigstream\n");
+    exit();
+  }
+  t = uptime();
+  for(i = 0; (n = read(fd, buf, sizeof(buf))) == sizeof(buf); i++){
+    if(((int*)buf)[0] != i){
+      printf(1, "read bigstream wrong data\n");
+      exit();
+    }
+  }
+  t = uptime() - t;
+  close(fd);
+  if(n != 0 || i != NSTREAM){
+    printf(1, "read bigstream wrong total\n");
+    exit();
+  }
+  printf(1, "bigstream: read %d KB in %d ticks\n", NSTREAM*sizeof(buf)/1024, t);
+  unlink("bigstream");
+
+  printf(1, "bigstream test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1347,7 +1673,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // the 50 was NINODE, when the inode cache had 50 fixed slots
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1744,6 +2070,10 @@ main(int argc, char *argv[])
   rmdot();
   fourteen();
   bigfile();
+  fragfile();
+  inlinefile();
+  mmaptest();
+  bigstream();
   subdir();
   linktest();
   unlinkread();
@@ -0,0 +1,312 @@
+// Driver for a virtio block device on the legacy PCI interface,
+// as provided by QEMU's virtio-blk-pci.  Used instead of ide.c
+// by kernelvirtio (make qemu-virtio); it serves the file system
+// disk, dev 1, and keeps many requests in flight at once.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+
+#define VIRTIO_VENDOR   0x1af4
+#define VIRTIO_BLKDEV   0x1001  // legacy block device
+
+// Legacy virtio registers, at offsets from the I/O base.
+#define VIO_DEVFEAT     0x00  // features the device offers
+#define VIO_GUESTFEAT   0x04  // features the driver accepts
+#define VIO_QADDR       0x08  // physical page number of queue
+#define VIO_QSIZE       0x0c  // entries in selected queue
+#define VIO_QSEL        0x0e  // queue selector
+#define VIO_QNOTIFY     0x10  // write queue number to kick device
+#define VIO_STATUS      0x12
+#define VIO_ISR         0x13  // reading acknowledges interrupt
+
+#define VIO_ST_ACK      0x01
+#define VIO_ST_DRIVER   0x02
+#define VIO_ST_DRIVEROK 0x04
+#define VIO_ST_FAILED   0x80
+
+#define VIRTIO_BLK_T_IN   0  // read
+#define VIRTIO_BLK_T_OUT  1  // write
+
+#define NUM 256  // max queue entries this driver supports
+
+#define SECTOR_SIZE 512  // virtio-blk addresses the disk in these
+
+// The virtqueue, laid out as the legacy interface requires:
+// descriptor table, then available ring, then, on the next
+// page, used ring.  All addresses are physical.
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT  1  // continues in next
+#define VRING_DESC_F_WRITE 2  // device writes (vs read)
+
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct {
+    uint id;  // head of completed descriptor chain
+    uint len;
+  } ring[];
+};
+
+// Request header; the data and a status byte follow.
+struct blkreq {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  int num;
+  struct vdesc *desc;
+  struct vavail *avail;
+  struct vused *used;
+  char free[NUM];  // is descriptor free?
+  ushort usedidx;  // how far ideintr has looked in used->ring
+
+  // Per request, indexed by the head descriptor of its chain.
+  struct {
+    struct buf *b;
+    struct blkreq hdr;
+    uchar status;
+  } info[NUM];
+
+  // Request statistics, printed and reset by idedump().
+  uint nreq;
+  uint wait;
+  uint maxwait;
+  uint inflight;
+  uint maxinflight;
+} vdisk;
+
+void
+ideinit(void)
+{
+  struct pcidev d;
+  int i;
+
+  initlock(&vdisk.lock, "virtio");
+  if(!pcifindid(VIRTIO_VENDOR, VIRTIO_BLKDEV, &d) || (d.bar[0] & 1) == 0)
+    panic("virtio: no block device");
+  pciwrite(&d, PCI_CMD, pciread(&d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+  vdisk.iobase = d.bar[0] & ~3;
+
+  outb(vdisk.iobase+VIO_STATUS, 0);  // reset
+  outb(vdisk.iobase+VIO_STATUS, VIO_ST_ACK | VIO_ST_DRIVER);
+  outl(vdisk.iobase+VIO_GUESTFEAT, 0);  // no optional features
+
+  outw(vdisk.iobase+VIO_QSEL, 0);
+  vdisk.num = inw(vdisk.iobase+VIO_QSIZE);
+  if(vdisk.num == 0 || vdisk.num > NUM){
+    outb(vdisk.iobase+VIO_STATUS, VIO_ST_FAILED);
+    panic("virtio: bad queue size");
+  }
+  vdisk.desc = (struct vdesc*)vqmem;
+  vdisk.avail = (struct vavail*)(vqmem + vdisk.num*sizeof(struct vdesc));
+  vdisk.used = (struct vused*)PGROUNDUP((uint)&vdisk.avail->ring[vdisk.num+1]);
+  for(i = 0; i < vdisk.num; i++)
+    vdisk.free[i] = 1;
+  outl(vdisk.iobase+VIO_QADDR, v2p(vqmem) >> PGSHIFT);
+
+  outb(vdisk.iobase+VIO_STATUS, VIO_ST_ACK | VIO_ST_DRIVER | VIO_ST_DRIVEROK);
+
+  // The device interrupts on a PCI line.  Through the I/O
+  // APIC, deliver it at the IDE vector so trap() calls
+  // ideintr().  The PIC can't move it to another vector,
+  // so tell trap() which line it is.
+  if(ismp)
+    ioapicroute(d.irq, T_IRQ0 + IRQ_IDE, ncpu - 1);
+  else {
+    ideirq = d.irq;
+    piclevel(d.irq);
+  }
+}
+
+// Allocate three descriptors for a request, or return -1.
+static int
+alloc3(int *idx)
+{
+  int i, n;
+
+  for(i = 0, n = 0; i < vdisk.num && n < 3; i++)
+    if(vdisk.free[i])
+      idx[n++] = i;
+  if(n < 3)
+    return -1;
+  for(i = 0; i < 3; i++)
+    vdisk.free[idx[i]] = 0;
+  return 0;
+}
+
+// Free the descriptor chain starting at i.
+static void
+freechain(int i)
+{
+  for(;;){
+    vdisk.free[i] = 1;
+    if(!(vdisk.desc[i].flags & VRING_DESC_F_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+  wakeup(&vdisk.free);
+}
+
+static void
+setdesc(int i, void *addr, int len, int flags, int next)
+{
+  vdisk.desc[i].addr = v2p(addr);
+  vdisk.desc[i].addrhi = 0;
+  vdisk.desc[i].len = len;
+  vdisk.desc[i].flags = flags;
+  vdisk.desc[i].next = next;
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct buf *b;
+  int id;
+  uint w;
+
+  acquire(&vdisk.lock);
+  // Acknowledge before looking at the used ring, so a
+  // request that finishes meanwhile interrupts again.
+  inb(vdisk.iobase+VIO_ISR);
+
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.num].id;
+    if(vdisk.info[id].status != 0)
+      panic("virtio: request failed");
+    b = vdisk.info[id].b;
+    vdisk.info[id].b = 0;
+    freechain(id);
+    vdisk.usedidx++;
+
+    w = ticks - b->qtime;
+    vdisk.nreq++;
+    vdisk.wait += w;
+    if(w > vdisk.maxwait)
+      vdisk.maxwait = w;
+    vdisk.inflight--;
+
+    // Wake process waiting for this buf.
+    // biodone may release b, so leave it alone afterwards.
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_IO);
+    wakeup(b);
+    biodone(b);
+  }
+
+  release(&vdisk.lock);
+}
+
+//PAGEBREAK!
+// Like iderw, but return as soon as b is queued.
+// The caller must not touch b until iderw_wait(b) returns
+// or b->iodone is called.
+void
+iderw_async(struct buf *b)
+{
+  int idx[3];
+  struct blkreq *hdr;
+
+  if(!(b->flags & B_BUSY))
+    panic("iderw: buf not busy");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+
+  acquire(&vdisk.lock);
+  while(alloc3(idx) < 0)
+    sleep(&vdisk.free, &vdisk.lock);
+
+  b->flags |= B_IO;
+  b->qtime = ticks;
+  vdisk.info[idx[0]].b = b;
+  vdisk.info[idx[0]].status = 0xff;  // device writes 0 on success
+  hdr = &vdisk.info[idx[0]].hdr;
+  hdr->type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  hdr->reserved = 0;
+  hdr->sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  hdr->sectorhi = 0;
+
+  setdesc(idx[0], hdr, sizeof(*hdr), VRING_DESC_F_NEXT, idx[1]);
+  setdesc(idx[1], b->data, BSIZE,
+          VRING_DESC_F_NEXT | ((b->flags & B_DIRTY) ? 0 : VRING_DESC_F_WRITE),
+          idx[2]);
+  setdesc(idx[2], &vdisk.info[idx[0]].status, 1, VRING_DESC_F_WRITE, 0);
+
+  // Publish the chain, then tell the device.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.num] = idx[0];
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  outw(vdisk.iobase+VIO_QNOTIFY, 0);
+
+  if(++vdisk.inflight > vdisk.maxinflight)
+    vdisk.maxinflight = vdisk.inflight;
+  release(&vdisk.lock);
+}
+
+// Wait for a request queued by iderw_async to finish.
+// Returns at once if none is in progress.
+void
+iderw_wait(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while(b->flags & B_IO)
+    sleep(b, &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  iderw_async(b);
+  iderw_wait(b);
+}
+
+// Print request statistics gathered since the last call,
+// then reset them.  Called on ^T from the console.
+void
+idedump(void)
+{
+  acquire(&vdisk.lock);
+  cprintf("virtio: %d requests, avg wait %d ticks, max %d; max %d in flight\n",
+          vdisk.nreq, vdisk.nreq ? vdisk.wait/vdisk.nreq : 0,
+          vdisk.maxwait, vdisk.maxinflight);
+  vdisk.nreq = vdisk.wait = vdisk.maxwait = 0;
+  vdisk.maxinflight = vdisk.inflight;
+  release(&vdisk.lock);
+}